@@ -0,0 +1,155 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#include "system.h"
+#ifdef ENABLE_AT_SPI2
+#include "a11y.h"
+#include "trace.h"
+#include <string.h>
+#include <atspi/atspi.h>
+
+#define A11Y_REGISTRY "org.a11y.atspi.Registry"
+#define A11Y_DEC_PATH "/org/a11y/atspi/registry/deviceeventcontroller"
+#define A11Y_DEC_INTERFACE "org.a11y.atspi.DeviceEventController"
+
+/* a key event waiting for the reply of the registry */
+struct a11y_call {
+	struct a11y *a11y;
+	guint code;
+	gboolean pressed;
+};
+
+/* called when the registry replied: fall back only if it failed */
+static void a11y_key_event_done(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	START_FUNC
+	struct a11y_call *call=(struct a11y_call *)user_data;
+	GError *error=NULL;
+	GVariant *ret=g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		/* the connection has been closed: call->a11y is gone */
+		g_error_free(error);
+		g_free(call);
+		END_FUNC
+		return;
+	}
+	call->a11y->pending--;
+	if (ret) g_variant_unref(ret);
+	else {
+		flo_warn(_("Unable to generate key event with at-spi: %s"), error->message);
+		g_error_free(error);
+		call->a11y->fallback(call->code, call->pressed, call->a11y->user_data);
+	}
+	g_free(call);
+	END_FUNC
+}
+
+/* generate a key event without waiting for the reply of the registry */
+void a11y_key_event(struct a11y *a11y, guint code, gboolean pressed)
+{
+	START_FUNC
+	struct a11y_call *call=g_malloc(sizeof(struct a11y_call));
+	call->a11y=a11y;
+	call->code=code;
+	call->pressed=pressed;
+	a11y->pending++;
+	g_dbus_connection_call(a11y->bus, A11Y_REGISTRY, A11Y_DEC_PATH, A11Y_DEC_INTERFACE,
+		"GenerateKeyboardEvent",
+		g_variant_new("(isu)", (gint)code, "", pressed?ATSPI_KEY_PRESS:ATSPI_KEY_RELEASE),
+		NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, a11y->cancellable, a11y_key_event_done, call);
+	END_FUNC
+}
+
+/* get the address of the accessibility bus */
+static gchar *a11y_address_get(void)
+{
+	START_FUNC
+	GError *error=NULL;
+	GDBusConnection *session;
+	GVariant *ret;
+	gchar *address=NULL;
+	if (g_getenv("AT_SPI_BUS_ADDRESS")) address=g_strdup(g_getenv("AT_SPI_BUS_ADDRESS"));
+	else if ((session=g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error))) {
+		ret=g_dbus_connection_call_sync(session, "org.a11y.Bus", "/org/a11y/bus", "org.a11y.Bus",
+			"GetAddress", NULL, G_VARIANT_TYPE("(s)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+		if (ret) {
+			g_variant_get(ret, "(s)", &address);
+			g_variant_unref(ret);
+		}
+		g_object_unref(session);
+	}
+	if (error) {
+		flo_warn(_("Unable to get the accessibility bus address: %s"), error->message);
+		g_error_free(error);
+	}
+	END_FUNC
+	return address;
+}
+
+/* connect to the accessibility bus. Returns NULL if the bus is not reachable. */
+struct a11y *a11y_new(a11y_fallback fallback, gpointer user_data)
+{
+	START_FUNC
+	GError *error=NULL;
+	struct a11y *a11y;
+	GDBusConnection *bus=NULL;
+	gchar *address=a11y_address_get();
+	if (address) {
+		bus=g_dbus_connection_new_for_address_sync(address,
+			G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT|G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+			NULL, NULL, &error);
+		if (!bus) {
+			flo_warn(_("Unable to connect to the accessibility bus: %s"), error->message);
+			g_error_free(error);
+		}
+		g_free(address);
+	}
+	if (!bus) {
+		END_FUNC
+		return NULL;
+	}
+	a11y=g_malloc(sizeof(struct a11y));
+	if (!a11y) flo_fatal(_("Unable to allocate memory for at-spi events"));
+	memset(a11y, 0, sizeof(struct a11y));
+	a11y->bus=bus;
+	a11y->cancellable=g_cancellable_new();
+	a11y->fallback=fallback;
+	a11y->user_data=user_data;
+	END_FUNC
+	return a11y;
+}
+
+/* liberate the connection */
+void a11y_free(struct a11y *a11y)
+{
+	START_FUNC
+	/* don't leave the last events behind */
+	if (a11y->pending) g_dbus_connection_flush_sync(a11y->bus, NULL, NULL);
+	g_cancellable_cancel(a11y->cancellable);
+	g_object_unref(a11y->cancellable);
+	g_dbus_connection_close_sync(a11y->bus, NULL, NULL);
+	g_object_unref(a11y->bus);
+	g_free(a11y);
+	END_FUNC
+}
+
+#endif
+
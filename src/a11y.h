@@ -0,0 +1,49 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#ifndef FLO_A11Y
+#define FLO_A11Y
+
+#include <gio/gio.h>
+
+/* called when the registry failed to generate a key event */
+typedef void (*a11y_fallback)(guint code, gboolean pressed, gpointer user_data);
+
+/* Sends the key events to the at-spi registry with asynchronous dbus calls.
+ * The calls are pipelined on the accessibility bus connection, which keeps them ordered. */
+struct a11y {
+	GDBusConnection *bus; /* accessibility bus */
+	guint pending; /* number of calls waiting for a reply */
+	GCancellable *cancellable; /* cancels the calls when the connection is closed */
+	a11y_fallback fallback; /* called when a call fails */
+	gpointer user_data; /* data of the fallback */
+};
+
+/* generate a key event without waiting for the reply of the registry */
+void a11y_key_event(struct a11y *a11y, guint code, gboolean pressed);
+
+/* connect to the accessibility bus. Returns NULL if the bus is not reachable. */
+struct a11y *a11y_new(a11y_fallback fallback, gpointer user_data);
+/* liberate the connection */
+void a11y_free(struct a11y *a11y);
+
+#endif
+
@@ -0,0 +1,344 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#include "system.h"
+#include "trace.h"
+#include "audio.h"
+#include <string.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#define AUDIO_RATE 44100
+#define AUDIO_CHANNELS 2
+/* frames per buffer: 10ms */
+#define AUDIO_CHUNK 441
+/* the pipeline is paused after 2s of silence */
+#define AUDIO_IDLE_CHUNKS 200
+#define AUDIO_CAPS "audio/x-raw-int, endianness=(int)1234, signed=(boolean)true, "\
+	"width=(int)16, depth=(int)16, rate=(int)44100, channels=(int)2"
+/* buffering of the audio sink in microseconds: keep it low for the clicks */
+#define AUDIO_SINK_BUFFER_TIME 40000
+#define AUDIO_SINK_LATENCY_TIME 10000
+/* longest time to wait for a sound to be decoded */
+#define AUDIO_DECODE_TIMEOUT (5*GST_SECOND)
+
+/* a sound being played */
+struct audio_voice {
+	struct audio_pcm *pcm; /* sound */
+	gsize offset; /* next frame to mix */
+	gint64 played; /* monotonic time of the play request */
+	gboolean started; /* TRUE once the first frames are mixed */
+};
+
+/* start of a sound in the stream (benchmark only) */
+struct audio_mark {
+	GstClockTime timestamp; /* timestamp of the buffer with the first frames */
+	gint64 played; /* monotonic time of the play request */
+};
+
+/* liberate a decoded sound */
+static void audio_pcm_free(gpointer data)
+{
+	struct audio_pcm *pcm=(struct audio_pcm *)data;
+	if (pcm) {
+		g_free(pcm->samples);
+		g_free(pcm);
+	}
+}
+
+/* decode the sound at uri to PCM. Returns NULL if it can't be decoded */
+static struct audio_pcm *audio_decode(const gchar *uri)
+{
+	START_FUNC
+	struct audio_pcm *pcm=NULL;
+	GstElement *pipeline, *decoder, *sink;
+	GstBuffer *buffer;
+	GstBus *bus;
+	GstMessage *msg;
+	GError *error=NULL;
+	GByteArray *data=g_byte_array_new();
+
+	pipeline=gst_parse_launch("uridecodebin name=decoder ! audioconvert ! audioresample ! "
+		"appsink name=sink sync=false caps=\"" AUDIO_CAPS "\"", &error);
+	if (!pipeline) {
+		flo_error(_("Unable to create the sound decoder: %s"), error->message);
+		g_error_free(error);
+		g_byte_array_free(data, TRUE);
+		END_FUNC
+		return NULL;
+	}
+	decoder=gst_bin_get_by_name(GST_BIN(pipeline), "decoder");
+	sink=gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	g_object_set(G_OBJECT(decoder), "uri", uri, NULL);
+	bus=gst_element_get_bus(pipeline);
+	if (gst_element_set_state(pipeline, GST_STATE_PLAYING)==GST_STATE_CHANGE_FAILURE) {
+		flo_warn(_("Unable to decode sound %s"), uri);
+	/* appsink queues the decoded buffers: wait for the end of the stream or an error */
+	} else if (!(msg=gst_bus_timed_pop_filtered(bus, AUDIO_DECODE_TIMEOUT,
+		GST_MESSAGE_ERROR|GST_MESSAGE_EOS))) {
+		flo_warn(_("Timeout while decoding sound %s"), uri);
+	} else if (GST_MESSAGE_TYPE(msg)==GST_MESSAGE_ERROR) {
+		gst_message_parse_error(msg, &error, NULL);
+		flo_warn(_("Unable to decode sound %s: %s"), uri, error->message);
+		g_error_free(error);
+		gst_message_unref(msg);
+	} else {
+		gst_message_unref(msg);
+		/* the stream has ended: NULL is returned once the queue is empty */
+		while ((buffer=gst_app_sink_pull_buffer(GST_APP_SINK(sink)))) {
+			g_byte_array_append(data, GST_BUFFER_DATA(buffer), GST_BUFFER_SIZE(buffer));
+			gst_buffer_unref(buffer);
+		}
+		if (data->len) {
+			pcm=g_malloc(sizeof(struct audio_pcm));
+			pcm->frames=data->len/(AUDIO_CHANNELS*sizeof(gint16));
+			pcm->samples=(gint16 *)g_byte_array_free(data, FALSE);
+			data=NULL;
+			flo_debug(TRACE_DEBUG, "[sound] %s decoded: %u frames", uri, (guint)pcm->frames);
+		}
+	}
+	gst_object_unref(bus);
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(decoder);
+	gst_object_unref(sink);
+	gst_object_unref(pipeline);
+	if (data) g_byte_array_free(data, TRUE);
+	END_FUNC
+	return pcm;
+}
+
+/* pause the pipeline after a silence: called on the main loop */
+static gboolean audio_pause(gpointer user_data)
+{
+	START_FUNC
+	struct audio *audio=(struct audio *)user_data;
+	gboolean pause;
+	g_mutex_lock(&(audio->lock));
+	pause=(!audio->voices) && (audio->idle>=AUDIO_IDLE_CHUNKS);
+	audio->pause_id=0;
+	g_mutex_unlock(&(audio->lock));
+	if (pause && audio->playing) {
+		gst_element_set_state(audio->pipeline, GST_STATE_PAUSED);
+		audio->playing=FALSE;
+	}
+	END_FUNC
+	return FALSE;
+}
+
+/* mix the playing sounds into the next buffer: called by appsrc in a streaming thread */
+static void audio_feed(GstElement *src, guint length, gpointer user_data)
+{
+	struct audio *audio=(struct audio *)user_data;
+	struct audio_voice *voice;
+	struct audio_mark *mark;
+	GstBuffer *buffer=gst_buffer_new_and_alloc(AUDIO_CHUNK*AUDIO_CHANNELS*sizeof(gint16));
+	gint16 *out=(gint16 *)GST_BUFFER_DATA(buffer);
+	gint32 mix[AUDIO_CHUNK*AUDIO_CHANNELS];
+	GSList *list, *next;
+	gsize n, i;
+
+	memset(mix, 0, sizeof(mix));
+	GST_BUFFER_TIMESTAMP(buffer)=gst_util_uint64_scale(audio->frames, GST_SECOND, AUDIO_RATE);
+	GST_BUFFER_DURATION(buffer)=gst_util_uint64_scale(AUDIO_CHUNK, GST_SECOND, AUDIO_RATE);
+	audio->frames+=AUDIO_CHUNK;
+
+	g_mutex_lock(&(audio->lock));
+	for (list=audio->voices; list; list=next) {
+		next=list->next;
+		voice=(struct audio_voice *)list->data;
+		n=MIN(AUDIO_CHUNK, voice->pcm->frames-voice->offset)*AUDIO_CHANNELS;
+		for (i=0; i<n; i++) mix[i]+=voice->pcm->samples[(voice->offset*AUDIO_CHANNELS)+i];
+		if ((!voice->started) && audio->benchmark) {
+			mark=g_malloc(sizeof(struct audio_mark));
+			mark->timestamp=GST_BUFFER_TIMESTAMP(buffer);
+			mark->played=voice->played;
+			g_queue_push_tail(audio->marks, mark);
+		}
+		voice->started=TRUE;
+		voice->offset+=n/AUDIO_CHANNELS;
+		if (voice->offset>=voice->pcm->frames) {
+			audio->voices=g_slist_delete_link(audio->voices, list);
+			g_free(voice);
+		}
+	}
+	if (audio->voices) audio->idle=0;
+	else if ((++audio->idle==AUDIO_IDLE_CHUNKS) && (!audio->pause_id))
+		audio->pause_id=g_idle_add(audio_pause, audio);
+	g_mutex_unlock(&(audio->lock));
+
+	/* overlapping sounds are added: clip the result */
+	for (i=0; i<AUDIO_CHUNK*AUDIO_CHANNELS; i++) out[i]=CLAMP(mix[i], G_MININT16, G_MAXINT16);
+	gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+}
+
+/* a buffer reached the fakesink: measure the latency of the sounds it starts (benchmark only) */
+static void audio_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data)
+{
+	struct audio *audio=(struct audio *)user_data;
+	struct audio_mark *mark;
+	gint64 now=g_get_monotonic_time(), latency;
+	g_mutex_lock(&(audio->lock));
+	while ((mark=g_queue_peek_head(audio->marks)) && mark->timestamp<=GST_BUFFER_TIMESTAMP(buffer)) {
+		g_queue_pop_head(audio->marks);
+		latency=now-mark->played;
+		audio->stats.count++;
+		audio->stats.total+=latency;
+		if (latency>audio->stats.max) audio->stats.max=latency;
+		g_free(mark);
+	}
+	g_mutex_unlock(&(audio->lock));
+}
+
+/* reduce the buffering of the audio sink chosen by autoaudiosink */
+static void audio_sink_added(GstBin *bin, GstElement *element, gpointer user_data)
+{
+	START_FUNC
+	GObjectClass *klass=G_OBJECT_GET_CLASS(element);
+	if (g_object_class_find_property(klass, "buffer-time"))
+		g_object_set(G_OBJECT(element), "buffer-time", (gint64)AUDIO_SINK_BUFFER_TIME, NULL);
+	if (g_object_class_find_property(klass, "latency-time"))
+		g_object_set(G_OBJECT(element), "latency-time", (gint64)AUDIO_SINK_LATENCY_TIME, NULL);
+	END_FUNC
+}
+
+/* Called on pipeline errors */
+static gboolean audio_bus_call(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+	GError *err;
+	if (GST_MESSAGE_TYPE(msg)==GST_MESSAGE_ERROR) {
+		gst_message_parse_error(msg, &err, NULL);
+		flo_error(_("An error occured while playing sound: %s"), err->message);
+		g_error_free(err);
+	}
+	return TRUE;
+}
+
+/* get the decoded sound of the uri, decode it if it is not yet */
+static struct audio_pcm *audio_pcm_get(struct audio *audio, const gchar *uri)
+{
+	START_FUNC
+	struct audio_pcm *pcm=NULL;
+	gpointer value;
+	if (g_hash_table_lookup_extended(audio->pcm, uri, NULL, &value)) pcm=(struct audio_pcm *)value;
+	else {
+		pcm=audio_decode(uri);
+		g_hash_table_insert(audio->pcm, g_strdup(uri), pcm);
+	}
+	END_FUNC
+	return pcm;
+}
+
+/* decode the sound of the uri in advance */
+void audio_load(struct audio *audio, const gchar *uri)
+{
+	START_FUNC
+	if (uri) audio_pcm_get(audio, uri);
+	END_FUNC
+}
+
+/* play the sound of the uri */
+void audio_play(struct audio *audio, const gchar *uri)
+{
+	START_FUNC
+	struct audio_voice *voice;
+	struct audio_pcm *pcm=uri?audio_pcm_get(audio, uri):NULL;
+	if (pcm) {
+		voice=g_malloc(sizeof(struct audio_voice));
+		memset(voice, 0, sizeof(struct audio_voice));
+		voice->pcm=pcm;
+		voice->played=g_get_monotonic_time();
+		g_mutex_lock(&(audio->lock));
+		audio->voices=g_slist_append(audio->voices, voice);
+		audio->idle=0;
+		g_mutex_unlock(&(audio->lock));
+		if (!audio->playing) {
+			gst_element_set_state(audio->pipeline, GST_STATE_PLAYING);
+			audio->playing=TRUE;
+		}
+	}
+	END_FUNC
+}
+
+/* create the audio engine. When the FLORENCE_AUDIO_BENCHMARK environment variable is set,
+ * the sounds are played to a fakesink and the latency is reported when the engine is freed. */
+struct audio *audio_new(void)
+{
+	START_FUNC
+	GstElement *convert, *resample, *sink;
+	GstCaps *caps;
+	GstBus *bus;
+	struct audio *audio=g_malloc(sizeof(struct audio));
+	if (!audio) flo_fatal(_("Unable to allocate memory for audio"));
+	memset(audio, 0, sizeof(struct audio));
+	g_mutex_init(&(audio->lock));
+	audio->pcm=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, audio_pcm_free);
+	audio->marks=g_queue_new();
+	audio->benchmark=(g_getenv("FLORENCE_AUDIO_BENCHMARK")!=NULL);
+
+	audio->pipeline=gst_pipeline_new("sounds");
+	audio->src=gst_element_factory_make("appsrc", "mixer");
+	convert=gst_element_factory_make("audioconvert", "convert");
+	resample=gst_element_factory_make("audioresample", "resample");
+	if (audio->benchmark) {
+		sink=gst_element_factory_make("fakesink", "sink");
+		g_object_set(G_OBJECT(sink), "sync", TRUE, "signal-handoffs", TRUE, NULL);
+		g_signal_connect(G_OBJECT(sink), "handoff", G_CALLBACK(audio_handoff), audio);
+	} else {
+		sink=gst_element_factory_make("autoaudiosink", "sink");
+		g_signal_connect(G_OBJECT(sink), "element-added", G_CALLBACK(audio_sink_added), audio);
+	}
+	caps=gst_caps_from_string(AUDIO_CAPS);
+	/* a single buffer is queued in the source: the sounds are mixed as late as possible */
+	g_object_set(G_OBJECT(audio->src), "caps", caps, "format", GST_FORMAT_TIME,
+		"max-bytes", (guint64)(AUDIO_CHUNK*AUDIO_CHANNELS*sizeof(gint16)), NULL);
+	gst_caps_unref(caps);
+	g_signal_connect(G_OBJECT(audio->src), "need-data", G_CALLBACK(audio_feed), audio);
+	gst_bin_add_many(GST_BIN(audio->pipeline), audio->src, convert, resample, sink, NULL);
+	if (!gst_element_link_many(audio->src, convert, resample, sink, NULL))
+		flo_error(_("Unable to create the sound pipeline"));
+	bus=gst_pipeline_get_bus(GST_PIPELINE(audio->pipeline));
+	audio->bus_id=gst_bus_add_watch(bus, audio_bus_call, audio);
+	gst_object_unref(bus);
+	/* preroll now: the first sound starts faster */
+	gst_element_set_state(audio->pipeline, GST_STATE_PAUSED);
+	END_FUNC
+	return audio;
+}
+
+/* liberate the audio engine */
+void audio_free(struct audio *audio)
+{
+	START_FUNC
+	gst_element_set_state(audio->pipeline, GST_STATE_NULL);
+	gst_object_unref(GST_OBJECT(audio->pipeline));
+	g_source_remove(audio->bus_id);
+	if (audio->pause_id) g_source_remove(audio->pause_id);
+	if (audio->benchmark && audio->stats.count) flo_info(_("Sound latency: %u sounds, "
+		"average=%" G_GINT64_FORMAT "us max=%" G_GINT64_FORMAT "us"), audio->stats.count,
+		audio->stats.total/audio->stats.count, audio->stats.max);
+	g_slist_free_full(audio->voices, g_free);
+	g_queue_free_full(audio->marks, g_free);
+	g_hash_table_destroy(audio->pcm);
+	g_mutex_clear(&(audio->lock));
+	g_free(audio);
+	END_FUNC
+}
+
@@ -0,0 +1,71 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#ifndef FLO_AUDIO
+#define FLO_AUDIO
+
+#include <glib.h>
+#include <gst/gst.h>
+
+/* a sound decoded to PCM (signed 16 bits interleaved stereo at 44100Hz) */
+struct audio_pcm {
+	gint16 *samples;
+	gsize frames; /* number of stereo frames */
+};
+
+/* latency from the play request to the sink (benchmark only) */
+struct audio_stats {
+	guint count; /* number of sounds measured */
+	gint64 total; /* sum of the latencies in microseconds */
+	gint64 max; /* worst latency in microseconds */
+};
+
+/* The audio engine plays the sounds with a single long lived pipeline:
+ * the sounds are decoded once, and the playing sounds are mixed into an appsrc. */
+struct audio {
+	GstElement *pipeline; /* appsrc ! audioconvert ! audioresample ! sink */
+	GstElement *src; /* source of the mixed sounds */
+	guint bus_id; /* bus watch of the pipeline */
+	GHashTable *pcm; /* decoded sounds by uri (NULL when it can't be decoded) */
+	GMutex lock; /* protects voices, idle, marks and stats (the mixing runs in a streaming thread) */
+	GSList *voices; /* sounds being played */
+	guint64 frames; /* number of frames sent to the pipeline */
+	guint idle; /* number of silent buffers sent since the last sound */
+	guint pause_id; /* idle source pausing the pipeline or 0 */
+	gboolean playing; /* TRUE when the pipeline is playing */
+	gboolean benchmark; /* measure the latency against a fakesink */
+	GQueue *marks; /* start of the sounds in the stream, waiting for the sink (benchmark only) */
+	struct audio_stats stats; /* latency statistics (benchmark only) */
+};
+
+/* decode the sound of the uri in advance */
+void audio_load(struct audio *audio, const gchar *uri);
+/* play the sound of the uri */
+void audio_play(struct audio *audio, const gchar *uri);
+
+/* create the audio engine. When the FLORENCE_AUDIO_BENCHMARK environment variable is set,
+ * the sounds are played to a fakesink and the latency is reported when the engine is freed. */
+struct audio *audio_new(void);
+/* liberate the audio engine */
+void audio_free(struct audio *audio);
+
+#endif
+
@@ -542,8 +542,8 @@ gboolean flo_timer_update(gpointer data)
 			flo_button_release_event(NULL, NULL, (void *)florence);
 			status_timer_start(florence->status, flo_timer_update, (gpointer)florence);
 		}
-		/* view update */
-		status_focus_set(florence->status, status_focus_get(florence->status));
+		/* view update: only the progress of the timer */
+		view_timer_update(florence->view);
 	} else ret=FALSE;
 	END_FUNC
 	return ret;
@@ -555,7 +555,11 @@ gboolean flo_to_top(gpointer data)
 	START_FUNC
 	struct florence *florence=data;
 	GtkWindow *window=GTK_WINDOW(view_window_get(florence->view));
-	if (!settings_get_bool(SETTINGS_KEEP_ON_TOP)) return FALSE;
+	if (!settings_get_bool(SETTINGS_KEEP_ON_TOP)) {
+		florence->to_top_id=0;
+		END_FUNC
+		return FALSE;
+	}
 	if (gtk_widget_get_visible(GTK_WIDGET(window))) gtk_window_present(window);
 	END_FUNC
 	return TRUE;
@@ -565,8 +569,9 @@ gboolean flo_to_top(gpointer data)
 void flo_start_keep_on_top(struct florence *florence, gboolean keep_on_top)
 {
 	START_FUNC
-	if (settings_get_bool(SETTINGS_KEEP_ON_TOP)) {
-		g_timeout_add(FLO_TO_TOP_TIMEOUT, flo_to_top, florence);
+	if (settings_get_bool(SETTINGS_KEEP_ON_TOP) && !florence->to_top_id) {
+		florence->to_top_id=scheduler_deadline_add(florence->view->scheduler,
+			FLO_TO_TOP_TIMEOUT, flo_to_top, florence);
 	}
 	END_FUNC
 }
@@ -578,7 +583,7 @@ gboolean flo_mouse_move_event(GtkWidget *window, GdkEvent *event, gpointer user_
 	START_FUNC
 #ifdef ENABLE_RAMBLE
 	enum key_hit hit;
-	gchar *algo;
+	const gchar *algo;
 #endif
 	struct florence *florence=(struct florence *)user_data;
 	if (status_get_moving(florence->status)) {
@@ -592,14 +597,13 @@ gboolean flo_mouse_move_event(GtkWidget *window, GdkEvent *event, gpointer user_
 		struct key *key=status_hit_get(florence->status, florence->xpos, florence->ypos, &hit);
 		if (status_im_get(florence->status)==STATUS_IM_RAMBLE) {
 			florence->view->ramble=florence->ramble;
-			algo=settings_get_string(SETTINGS_RAMBLE_ALGO);
+			algo=settings_peek_string(SETTINGS_RAMBLE_ALGO);
 			if ((hit==KEY_BORDER) &&
 				(status_focus_get(florence->status)==key) &&
 				(!strcmp("time", algo))) {
 				ramble_time_reset(florence->ramble);
 				status_focus_set(florence->status, NULL);
 			}
-			if (algo) g_free(algo);
 			if (ramble_started(florence->ramble) &&
 				ramble_add(florence->ramble, gtk_widget_get_window(GTK_WIDGET(florence->view->window)),
 					florence->xpos, florence->ypos, key)) {
@@ -693,6 +697,7 @@ void flo_layout_load(struct florence *florence)
 
 	/* create the style object */
 	florence->style=style_new(NULL);
+	style_sound_update(florence->style);
 
 	/* create the keyboard objects */
 	florence->keyboards=flo_keyboards_load(florence, layout);
@@ -713,6 +718,15 @@ void flo_layout_reload(GSettings *settings, gchar *key, gpointer user_data)
 	END_FUNC
 }
 
+/* the sounds setting has changed */
+void flo_set_sounds(GSettings *settings, gchar *key, gpointer user_data)
+{
+	START_FUNC
+	struct florence *florence=(struct florence *)user_data;
+	if (florence->style) style_sound_update(florence->style);
+	END_FUNC
+}
+
 /* create a new instance of florence. */
 struct florence *flo_new(gboolean gnome, const gchar *focus_back)
 {
@@ -766,6 +780,7 @@ struct florence *flo_new(gboolean gnome, const gchar *focus_back)
 	/* TODO: just reload the style, no need to reload the whole layout */
 	settings_changecb_register(SETTINGS_STYLE_ITEM, flo_layout_reload, florence);
 	settings_changecb_register(SETTINGS_FILE, flo_layout_reload, florence);
+	settings_changecb_register(SETTINGS_SOUNDS, flo_set_sounds, florence);
 
 	florence->service=service_new(florence->view, flo_terminate);
 	END_FUNC
@@ -800,6 +815,7 @@ void flo_free(struct florence *florence)
 #endif
 	if (florence->service) service_free(florence->service);
 	g_free(florence);
+	layoutreader_exit();
 	xmlCleanupParser();
 	xmlMemoryDump();
 	END_FUNC
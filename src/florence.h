@@ -44,6 +44,7 @@ struct florence {
 	struct trayicon *trayicon; /* tray icon object */
 	GtkWindow *icon; /* intermediate icon */
 	gint xpos, ypos; /* remember pointer position */
+	guint to_top_id; /* scheduler task bringing the window back to front or 0 */
 #ifdef ENABLE_RAMBLE
 	struct ramble *ramble; /* track the path of the mouse. */
 #endif
@@ -0,0 +1,438 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#include "system.h"
+#include "inject.h"
+#include "trace.h"
+#include <string.h>
+#include <errno.h>
+#include <gdk/gdk.h>
+#include <X11/extensions/XTest.h>
+#ifdef ENABLE_XKB
+#include <X11/XKBlib.h>
+#endif
+#ifdef HAVE_LINUX_UINPUT_H
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/uinput.h>
+#endif
+
+/* the X key codes are the evdev key codes shifted by 8 */
+#define INJECT_EVDEV_OFFSET 8
+/* time given to the X server to add a new uinput device (us) */
+#define INJECT_UINPUT_SETTLE 200000
+
+/* an event waiting in the queue */
+struct inject_record {
+	struct inject_event event; /* event to send */
+	gint64 queued; /* monotonic time of the enqueue */
+	gint64 flushed; /* monotonic time of the flush */
+	gint64 due; /* monotonic time when a delayed mapping is changed */
+	inject_done done; /* completion callback of the sequence or NULL */
+	gpointer user_data; /* data of the completion callback */
+};
+
+/* marks the end of the queue: the worker exits when it pops it */
+static struct inject_record inject_stop;
+
+/* the injection whose X errors are trapped */
+static struct inject *inject_trapped=NULL;
+/* error handler of the other displays */
+static XErrorHandler inject_error_next=NULL;
+
+/* X error handler: the errors of the worker display are counted and reported on the main loop,
+ * instead of reaching the gdk handler (or the default one, which exits) in the worker thread.
+ * A key code of the dbus service may be wrong, for example. */
+static int inject_error_handler(Display *disp, XErrorEvent *error)
+{
+	if (inject_trapped && (disp==inject_trapped->display)) {
+		g_atomic_int_set(&(inject_trapped->error_code), error->error_code);
+		g_atomic_int_inc(&(inject_trapped->errors));
+		return 0;
+	}
+	return inject_error_next?inject_error_next(disp, error):0;
+}
+
+/* xtest backend: the events are sent on the worker display */
+static gboolean inject_xtest_open(struct inject *inject) { return TRUE; }
+static void inject_xtest_key(struct inject *inject, guint code, gboolean pressed)
+	{ XTestFakeKeyEvent(inject->display, code, pressed, 0); }
+static void inject_xtest_flush(struct inject *inject) { XFlush(inject->display); }
+static void inject_xtest_close(struct inject *inject) {}
+
+#ifdef HAVE_LINUX_UINPUT_H
+/* uinput backend: create a virtual keyboard device */
+static gboolean inject_uinput_open(struct inject *inject)
+{
+	START_FUNC
+	struct uinput_user_dev dev;
+	int code;
+	gboolean ret=FALSE;
+	if ((inject->fd=open("/dev/uinput", O_WRONLY|O_NONBLOCK))<0) {
+		flo_warn(_("Unable to open /dev/uinput: %s"), g_strerror(errno));
+	} else {
+		memset(&dev, 0, sizeof(struct uinput_user_dev));
+		g_strlcpy(dev.name, "Florence virtual keyboard", UINPUT_MAX_NAME_SIZE);
+		dev.id.bustype=BUS_VIRTUAL;
+		dev.id.version=1;
+		ret=(ioctl(inject->fd, UI_SET_EVBIT, EV_KEY)>=0) && (ioctl(inject->fd, UI_SET_EVBIT, EV_SYN)>=0);
+		for (code=0; ret && code<=0xFF-INJECT_EVDEV_OFFSET; code++)
+			ret=ioctl(inject->fd, UI_SET_KEYBIT, code)>=0;
+		ret=ret && (write(inject->fd, &dev, sizeof(struct uinput_user_dev))==sizeof(struct uinput_user_dev)) &&
+			(ioctl(inject->fd, UI_DEV_CREATE)>=0);
+		if (!ret) {
+			flo_warn(_("Unable to create the uinput device: %s"), g_strerror(errno));
+			close(inject->fd);
+		} else {
+			inject->buffer=g_array_new(FALSE, TRUE, sizeof(struct input_event));
+			/* the events written before the X server opened the device would be lost */
+			inject->settled=g_get_monotonic_time()+INJECT_UINPUT_SETTLE;
+		}
+	}
+	END_FUNC
+	return ret;
+}
+
+/* append an input event to the buffer */
+static void inject_uinput_append(struct inject *inject, guint16 type, guint16 code, gint32 value)
+{
+	struct input_event event;
+	memset(&event, 0, sizeof(struct input_event));
+	event.type=type;
+	event.code=code;
+	event.value=value;
+	g_array_append_val(inject->buffer, event);
+}
+
+/* uinput backend: each key event is reported in its own frame */
+static void inject_uinput_key(struct inject *inject, guint code, gboolean pressed)
+{
+	if (code<INJECT_EVDEV_OFFSET) return;
+	inject_uinput_append(inject, EV_KEY, code-INJECT_EVDEV_OFFSET, pressed?1:0);
+	inject_uinput_append(inject, EV_SYN, SYN_REPORT, 0);
+}
+
+/* uinput backend: the whole batch is written at once */
+static void inject_uinput_flush(struct inject *inject)
+{
+	gsize len=inject->buffer->len*sizeof(struct input_event);
+	gint64 now;
+	if (len && inject->settled) {
+		now=g_get_monotonic_time();
+		if (now<inject->settled) g_usleep(inject->settled-now);
+		inject->settled=0;
+	}
+	if (len && (write(inject->fd, inject->buffer->data, len)!=(ssize_t)len))
+		flo_warn(_("Unable to write to the uinput device: %s"), g_strerror(errno));
+	g_array_set_size(inject->buffer, 0);
+}
+
+/* uinput backend: destroy the virtual keyboard */
+static void inject_uinput_close(struct inject *inject)
+{
+	START_FUNC
+	ioctl(inject->fd, UI_DEV_DESTROY);
+	close(inject->fd);
+	g_array_free(inject->buffer, TRUE);
+	END_FUNC
+}
+#endif
+
+/* available backends. The first one is the default.
+ * The uinput events reach the X server through the kernel, asynchronously with the requests
+ * of the worker display: a mapping change may be applied before the previous key events */
+static const struct inject_backend inject_backends[]={
+	{ "xtest", TRUE, inject_xtest_open, inject_xtest_key, inject_xtest_flush, inject_xtest_close },
+#ifdef HAVE_LINUX_UINPUT_H
+	{ "uinput", FALSE, inject_uinput_open, inject_uinput_key, inject_uinput_flush, inject_uinput_close },
+#endif
+};
+
+/* report the latency of the last batches to the main loop */
+static gboolean inject_report(gpointer data)
+{
+	START_FUNC
+	struct inject *inject=(struct inject *)data;
+	struct inject_stats stats;
+	guint errors;
+	g_atomic_int_set(&(inject->report_pending), FALSE);
+	inject_stats_get(inject, &stats);
+	if (stats.events) flo_debug(TRACE_DEBUG,
+		_("%s: %" G_GUINT64_FORMAT " key events injected in %" G_GUINT64_FORMAT
+		" flushes; latency: average=%" G_GINT64_FORMAT "us max=%" G_GINT64_FORMAT "us"),
+		inject->backend->name, stats.events, stats.batches, stats.latency_total/(gint64)stats.events,
+		stats.latency_max);
+	if ((errors=g_atomic_int_and((guint *)&(inject->errors), 0)))
+		flo_warn(_("%u X errors on the key injection display (last error code: %d)"),
+			errors, g_atomic_int_get(&(inject->error_code)));
+	END_FUNC
+	return FALSE;
+}
+
+/* call the completion callback of a sequence on the main loop */
+static gboolean inject_complete(gpointer data)
+{
+	START_FUNC
+	struct inject_record *rec=(struct inject_record *)data;
+	rec->done(rec->flushed, rec->user_data);
+	g_free(rec);
+	END_FUNC
+	return FALSE;
+}
+
+/* change the delayed mappings that are due, or all of them if wait is TRUE.
+ * Returns the due time of the next delayed mapping or 0 if there is none */
+static gint64 inject_delayed_send(struct inject *inject, gboolean wait)
+{
+	struct inject_record *rec;
+	gint64 now;
+	gboolean sent=FALSE;
+	while ((rec=(struct inject_record *)g_queue_peek_head(inject->delayed))) {
+		now=g_get_monotonic_time();
+		if (rec->due>now) {
+			if (!wait) break;
+			g_usleep(rec->due-now);
+		}
+		XChangeKeyboardMapping(inject->display, rec->event.code, 1, &(rec->event.keysym), 1);
+		g_free(g_queue_pop_head(inject->delayed));
+		sent=TRUE;
+	}
+	if (sent) XFlush(inject->display);
+	return rec?rec->due:0;
+}
+
+/* send an event on the worker display */
+static void inject_send(struct inject *inject, struct inject_event *event)
+{
+	struct inject_record *rec;
+	switch (event->type) {
+		case INJECT_PRESS:
+		case INJECT_RELEASE:
+			inject->backend->key(inject, event->code, event->type==INJECT_PRESS);
+			break;
+		case INJECT_MAP:
+			if (event->delay) {
+				rec=g_malloc(sizeof(struct inject_record));
+				memset(rec, 0, sizeof(struct inject_record));
+				memcpy(&(rec->event), event, sizeof(struct inject_event));
+				rec->due=g_get_monotonic_time()+event->delay*1000;
+				g_queue_push_tail(inject->delayed, rec);
+				break;
+			}
+			/* a delayed mapping may be on the same key code */
+			inject_delayed_send(inject, TRUE);
+			/* the key events before the mapping must use the previous one */
+			inject->backend->flush(inject);
+			XChangeKeyboardMapping(inject->display, event->code, 1, &(event->keysym), 1);
+			/* the mapping must be effective before the next key event is sent */
+			XSync(inject->display, False);
+			break;
+		case INJECT_MODS:
+			inject->backend->flush(inject);
+#ifdef ENABLE_XKB
+			XkbLockModifiers(inject->display, XkbUseCoreKbd, event->code, event->mods);
+			XkbLatchModifiers(inject->display, XkbUseCoreKbd, event->code, 0);
+#endif
+			XSync(inject->display, False);
+			break;
+		case INJECT_WAIT:
+			inject->backend->flush(inject);
+			XSync(inject->display, False);
+			g_usleep(event->code*1000);
+			break;
+	}
+}
+
+/* worker thread: send every queued event, then flush once per batch */
+static gpointer inject_run(gpointer data)
+{
+	struct inject *inject=(struct inject *)data;
+	struct inject_record *rec;
+	GSList *batch, *list;
+	gboolean stop=FALSE;
+	gint64 now, latency, due;
+
+	while (!stop) {
+		/* block until the first event or the next delayed mapping,
+		 * then take everything queued meanwhile */
+		batch=NULL;
+		if ((due=inject_delayed_send(inject, FALSE))) {
+			now=g_get_monotonic_time();
+			if (!(rec=g_async_queue_timeout_pop(inject->queue, due>now?due-now:0))) continue;
+		} else rec=g_async_queue_pop(inject->queue);
+		do {
+			if (rec==&inject_stop) { stop=TRUE; break; }
+			inject_send(inject, &(rec->event));
+			batch=g_slist_prepend(batch, rec);
+		} while ((rec=g_async_queue_try_pop(inject->queue)));
+		if (!batch) continue;
+		inject->backend->flush(inject);
+		now=g_get_monotonic_time();
+
+		g_mutex_lock(&(inject->lock));
+		inject->stats.batches++;
+		for (list=batch;list;list=list->next) {
+			rec=(struct inject_record *)list->data;
+			if ((rec->event.type==INJECT_PRESS) || (rec->event.type==INJECT_RELEASE)) {
+				latency=now-rec->queued;
+				inject->stats.events++;
+				inject->stats.latency_total+=latency;
+				if (latency>inject->stats.latency_max) inject->stats.latency_max=latency;
+			}
+		}
+		g_mutex_unlock(&(inject->lock));
+		/* the batch is reversed: restore the order of the completions */
+		batch=g_slist_reverse(batch);
+		for (list=batch;list;list=list->next) {
+			rec=(struct inject_record *)list->data;
+			if (rec->done) {
+				rec->flushed=now;
+				g_idle_add(inject_complete, rec);
+			} else g_free(rec);
+		}
+		g_slist_free(batch);
+
+		if (g_atomic_int_compare_and_exchange(&(inject->report_pending), FALSE, TRUE))
+			g_idle_add(inject_report, inject);
+	}
+	/* give the spare key codes back before the display is closed */
+	inject_delayed_send(inject, TRUE);
+	XSync(inject->display, False);
+	return NULL;
+}
+
+/* queue a key event to be sent by the worker */
+void inject_key(struct inject *inject, guint code, gboolean pressed)
+{
+	START_FUNC
+	struct inject_record *rec=g_malloc(sizeof(struct inject_record));
+	memset(rec, 0, sizeof(struct inject_record));
+	rec->event.type=pressed?INJECT_PRESS:INJECT_RELEASE;
+	rec->event.code=code;
+	rec->queued=g_get_monotonic_time();
+	g_async_queue_push(inject->queue, rec);
+	END_FUNC
+}
+
+/* queue a sequence of events to be sent in a single batch.
+ * done is called on the main loop once the sequence is flushed.
+ * Returns FALSE if the backend can't send the mapping or modifier changes of the sequence */
+gboolean inject_sequence(struct inject *inject, struct inject_event *events, guint n,
+	inject_done done, gpointer user_data)
+{
+	START_FUNC
+	struct inject_record *rec;
+	gint64 now=g_get_monotonic_time();
+	guint i;
+	for (i=0; (!inject->backend->mapping) && i<n; i++) {
+		if ((events[i].type==INJECT_MAP) || (events[i].type==INJECT_MODS)) {
+			END_FUNC
+			return FALSE;
+		}
+	}
+	/* the queue is locked so that the worker pops the whole sequence at once */
+	g_async_queue_lock(inject->queue);
+	for (i=0;i<n;i++) {
+		rec=g_malloc(sizeof(struct inject_record));
+		memset(rec, 0, sizeof(struct inject_record));
+		memcpy(&(rec->event), &(events[i]), sizeof(struct inject_event));
+		rec->queued=now;
+		if (i==n-1) {
+			rec->done=done;
+			rec->user_data=user_data;
+		}
+		g_async_queue_push_unlocked(inject->queue, rec);
+	}
+	g_async_queue_unlock(inject->queue);
+	END_FUNC
+	return TRUE;
+}
+
+/* copy the latency statistics */
+void inject_stats_get(struct inject *inject, struct inject_stats *stats)
+{
+	START_FUNC
+	g_mutex_lock(&(inject->lock));
+	memcpy(stats, &(inject->stats), sizeof(struct inject_stats));
+	g_mutex_unlock(&(inject->lock));
+	END_FUNC
+}
+
+/* start the injection worker. Returns NULL if the display can't be opened. */
+struct inject *inject_new(const gchar *backend)
+{
+	START_FUNC
+	struct inject *inject;
+	guint i;
+	Display *disp=XOpenDisplay(gdk_display_get_name(gdk_display_get_default()));
+	if (!disp) {
+		flo_warn(_("Unable to open a display for the key injection: sending events synchronously."));
+		END_FUNC
+		return NULL;
+	}
+	inject=g_malloc(sizeof(struct inject));
+	if (!inject) flo_fatal(_("Unable to allocate memory for key injection"));
+	memset(inject, 0, sizeof(struct inject));
+	inject->display=disp;
+	inject->backend=&inject_backends[0];
+	for (i=0; i<G_N_ELEMENTS(inject_backends); i++) {
+		if (!g_strcmp0(backend, inject_backends[i].name)) inject->backend=&inject_backends[i];
+	}
+	if (g_strcmp0(backend, inject->backend->name))
+		flo_warn(_("Unknown key injection backend: %s"), backend);
+	if (!inject->backend->open(inject)) {
+		flo_warn(_("Key injection backend %s is not available: using %s instead."),
+			inject->backend->name, inject_backends[0].name);
+		inject->backend=&inject_backends[0];
+	}
+	flo_info(_("Key injection backend: %s"), inject->backend->name);
+	inject->queue=g_async_queue_new();
+	inject->delayed=g_queue_new();
+	g_mutex_init(&(inject->lock));
+	inject_trapped=inject;
+	inject_error_next=XSetErrorHandler(inject_error_handler);
+	inject->thread=g_thread_new("inject", inject_run, inject);
+	END_FUNC
+	return inject;
+}
+
+/* flush the pending events and stop the worker */
+void inject_free(struct inject *inject)
+{
+	START_FUNC
+	if (inject) {
+		g_async_queue_push(inject->queue, &inject_stop);
+		g_thread_join(inject->thread);
+		g_idle_remove_by_data(inject);
+		inject_report(inject);
+		XSetErrorHandler(inject_error_next);
+		inject_trapped=NULL;
+		g_async_queue_unref(inject->queue);
+		g_queue_free(inject->delayed);
+		g_mutex_clear(&(inject->lock));
+		inject->backend->close(inject);
+		XCloseDisplay(inject->display);
+		g_free(inject);
+	}
+	END_FUNC
+}
+
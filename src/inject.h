@@ -0,0 +1,106 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#ifndef FLO_INJECT
+#define FLO_INJECT
+
+#include <glib.h>
+#include <X11/Xlib.h>
+
+/* type of the events of a sequence */
+enum inject_type {
+	INJECT_PRESS, /* press the key code */
+	INJECT_RELEASE, /* release the key code */
+	INJECT_MAP, /* bind the keysym to the key code (NoSymbol to unbind it) */
+	INJECT_MODS, /* set the locked modifiers of the mask in code to mods and clear their latches */
+	INJECT_WAIT /* wait for code milliseconds (to let the clients handle a mapping change).
+		The worker sleeps: every event queued after it waits too, including the keyboard keys */
+};
+
+/* an event of a sequence */
+struct inject_event {
+	enum inject_type type;
+	guint code; /* key code, modifier mask (INJECT_MODS) or milliseconds (INJECT_WAIT) */
+	KeySym keysym; /* keysym to bind (INJECT_MAP only) */
+	guint mods; /* locked modifiers (INJECT_MODS only) */
+	guint delay; /* milliseconds before the mapping is changed, without holding the next events (INJECT_MAP only) */
+};
+
+/* called on the main loop when a sequence has been flushed.
+ * flushed is the monotonic time of the flush */
+typedef void (*inject_done)(gint64 flushed, gpointer user_data);
+
+struct inject;
+
+/* a backend sends the key events of the worker to the system */
+struct inject_backend {
+	const gchar *name; /* name of the backend in the settings */
+	gboolean mapping; /* TRUE if the key mapping and modifier changes are ordered with the key events */
+	gboolean (*open)(struct inject *inject); /* returns FALSE if the backend is not available */
+	void (*key)(struct inject *inject, guint code, gboolean pressed); /* send an X key code event */
+	void (*flush)(struct inject *inject); /* send the pending events */
+	void (*close)(struct inject *inject);
+};
+
+/* latency statistics of the injected events (from enqueue to flush) */
+struct inject_stats {
+	guint64 events; /* number of events flushed */
+	guint64 batches; /* number of flushes */
+	gint64 latency_total; /* sum of the latencies in microseconds */
+	gint64 latency_max; /* worst latency in microseconds */
+};
+
+/* The injection queue sends the key events in a worker thread,
+ * so that rendering on the main loop does not delay the keystrokes. */
+struct inject {
+	GThread *thread; /* worker draining the queue */
+	GAsyncQueue *queue; /* pending events (struct inject_record) */
+	Display *display; /* X connection owned by the worker (key mapping and xtest backend) */
+	const struct inject_backend *backend; /* backend sending the key events */
+	int fd; /* uinput device */
+	gint64 settled; /* monotonic time when the uinput device can be used */
+	GArray *buffer; /* uinput events waiting for the flush */
+	GQueue *delayed; /* delayed mappings, by due time (struct inject_record) */
+	GMutex lock; /* protects stats */
+	struct inject_stats stats; /* latency statistics */
+	gint errors; /* number of X errors on the worker display */
+	gint error_code; /* code of the last X error on the worker display */
+	gint report_pending; /* TRUE when a completion report is scheduled on the main loop */
+};
+
+/* queue a key event to be sent by the worker */
+void inject_key(struct inject *inject, guint code, gboolean pressed);
+/* queue a sequence of events to be sent in a single batch.
+ * done is called on the main loop once the sequence is flushed.
+ * Returns FALSE if the backend can't send the mapping or modifier changes of the sequence */
+gboolean inject_sequence(struct inject *inject, struct inject_event *events, guint n,
+	inject_done done, gpointer user_data);
+/* copy the latency statistics */
+void inject_stats_get(struct inject *inject, struct inject_stats *stats);
+
+/* start the injection worker with the named backend ("xtest" or "uinput").
+ * Returns NULL if the display can't be opened. */
+struct inject *inject_new(const gchar *backend);
+/* flush the pending events and stop the worker */
+void inject_free(struct inject *inject);
+
+#endif
+
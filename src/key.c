@@ -38,6 +38,7 @@
 #endif
 #ifdef ENABLE_XTST
 #include <X11/extensions/XTest.h>
+#include "inject.h"
 #endif
 #include <cairo/cairo-xlib.h>
 
@@ -104,6 +105,25 @@ void key_modifier_append (struct layout_modifier *mod, void *object, void *xkb)
 	END_FUNC
 }
 
+/* find the modifiers that change the symbol drawn on the key */
+GdkModifierType key_sensitivity_get(struct key *key, struct xkeyboard *xkeyboard)
+{
+	START_FUNC
+	GSList *list=key->mods;
+	struct key_mod *mod;
+	GdkModifierType ret=0;
+	while (list) {
+		mod=(struct key_mod *)list->data;
+		/* the modification itself depends on the modifier */
+		ret|=mod->modifier;
+		if (mod->type==KEY_CODE)
+			ret|=xkeyboard_key_sensitivity_get(xkeyboard, ((struct key_code *)mod->data)->code);
+		list=list->next;
+	}
+	END_FUNC
+	return ret;
+}
+
 /* Instanciates a key
  * the key may have a static label which will be always drawn in place of the symbol */
 struct key *key_new(struct layout *layout, struct style *style, struct xkeyboard *xkeyboard, void *keyboard)
@@ -123,6 +143,7 @@ struct key *key_new(struct layout *layout, struct style *style, struct xkeyboard
 		key->w=lkey->size.w==0.0?2.0:lkey->size.w;
 		key->h=lkey->size.h==0.0?2.0:lkey->size.h;
 		key->keyboard=keyboard;
+		key->sensitivity=key_sensitivity_get(key, xkeyboard);
 		layoutreader_key_free(lkey);
 		flo_debug(TRACE_DEBUG, "[new key] x=%f y=%f w=%f h=%f",
 			key->x, key->y, key->w, key->h);
@@ -157,16 +178,30 @@ void key_free(struct key *key)
 	END_FUNC
 }
 
+#ifdef ENABLE_AT_SPI2
+/* send the event to at-spi. The asynchronous calls are used when the accessibility bus is connected:
+ * the failures are reported later to the status, which falls back to Xtest */
+static gboolean key_spi_event(unsigned int code, gboolean pressed, struct status *status)
+{
+	START_FUNC
+	gboolean ret=TRUE;
+	if (status->a11y) a11y_key_event(status->a11y, code, pressed);
+	else ret=atspi_generate_keyboard_event(code, NULL, pressed?ATSPI_KEY_PRESS:ATSPI_KEY_RELEASE, NULL);
+	END_FUNC
+	return ret;
+}
+#endif
+
 /* send a simple event: press (pressed=TRUE) or release (pressed=FALSE) */
-gboolean key_event(unsigned int code, gboolean pressed, gboolean spi_enabled)
+gboolean key_event(unsigned int code, gboolean pressed, struct status *status)
 {
 	START_FUNC
 	gboolean ret=TRUE;
 #ifdef ENABLE_XTST
-	if (spi_enabled)
+	if (status->spi)
 #ifdef AT_SPI
 #ifdef ENABLE_AT_SPI2
-		ret=atspi_generate_keyboard_event(code, NULL, pressed?ATSPI_KEY_PRESS:ATSPI_KEY_RELEASE, NULL);
+		ret=key_spi_event(code, pressed, status);
 #else
 		ret=SPI_generateKeyboardEvent(code, NULL, pressed?SPI_KEY_PRESS:SPI_KEY_RELEASE);
 #endif
@@ -174,8 +209,16 @@ gboolean key_event(unsigned int code, gboolean pressed, gboolean spi_enabled)
 #else
 		flo_fatal(_("Unreachable code"));
 #endif
-	if (!(ret && spi_enabled)) {
-		XTestFakeKeyEvent(
+	if (!(ret && status->spi)) {
+		/* let the injection worker send it, so that drawing doesn't delay it */
+		if (status->inject) {
+			/* the worker has its own connection: the focus and group changes must come first */
+			if (status->inject_sync) {
+				XSync((Display *)gdk_x11_get_default_xdisplay(), False);
+				status->inject_sync=FALSE;
+			}
+			inject_key(status->inject, code, pressed);
+		} else XTestFakeKeyEvent(
 			(Display *)gdk_x11_get_default_xdisplay(),
 			code, pressed, 0);
 		ret=FALSE;
@@ -183,7 +226,7 @@ gboolean key_event(unsigned int code, gboolean pressed, gboolean spi_enabled)
 #else
 #ifdef AT_SPI
 #ifdef ENABLE_AT_SPI2
-	ret=atspi_generate_keyboard_event(code NULL, pressed?ATSPI_KEY_PRESS:ATSPI_KEY_RELEASE);
+	ret=key_spi_event(code, pressed, status);
 #else
 	ret=SPI_generateKeyboardEvent(code, NULL, pressed?SPI_KEY_PRESS:SPI_KEY_RELEASE);
 #endif
@@ -287,7 +330,7 @@ void key_press(struct key *key, struct status *status)
 	if (mod) {
 		switch (mod->type) {
 			case KEY_CODE:
-				status->spi=key_event(((struct key_code *)mod->data)->code, TRUE, status->spi);
+				status->spi=key_event(((struct key_code *)mod->data)->code, TRUE, status);
 				if (settings_get_bool(SETTINGS_SOUNDS) && status->view)
 					style_sound_play(status->view->style,
 						gdk_keyval_name(xkeyboard_getKeyval(status->xkeyboard,
@@ -330,7 +373,7 @@ void key_release(struct key *key, struct status *status)
 	if (mod) {
 		switch (mod->type) {
 			case KEY_CODE:
-				status->spi=key_event(((struct key_code *)mod->data)->code, FALSE, status->spi);
+				status->spi=key_event(((struct key_code *)mod->data)->code, FALSE, status);
 				if (settings_get_bool(SETTINGS_SOUNDS) && status->view)
 					style_sound_play(status->view->style,
 						gdk_keyval_name(xkeyboard_getKeyval(status->xkeyboard,
@@ -356,7 +399,9 @@ void key_release(struct key *key, struct status *status)
 							settings_get_double(SETTINGS_SCALEY)*0.95, TRUE);
 						break;
 					case KEY_SWITCH:
-						xkeyboard_layout_change(status->xkeyboard); break;
+						xkeyboard_layout_change(status->xkeyboard);
+						status_inject_order(status);
+						break;
 					case KEY_EXTEND: key_extend(action); break;
 					case KEY_UNEXTEND: key_unextend(action);
 						if (settings_get_bool(SETTINGS_SOUNDS) && status->view)
@@ -373,24 +418,68 @@ void key_release(struct key *key, struct status *status)
 	END_FUNC
 }
 
+/* corners of the key, by timer value */
+static const gdouble key_timer_corners[][3]={
+	{ 0.125, 1.0, 0.0 }, { 0.375, 1.0, 1.0 }, { 0.625, 0.0, 1.0 }, { 0.875, 0.0, 0.0 } };
+
+/* get the point of the border of the unit square reached by the timer value:
+ * the timer runs clockwise from the middle of the top side */
+static void key_timer_point(gdouble value, gdouble *x, gdouble *y)
+{
+	if (value<0.125 || value>0.875) { *x=0.5+(0.5*tan(value*2.0*PI)); *y=0.0; }
+	else if (value<0.375) { *x=1.0; *y=0.5+(0.5*tan((value-0.25)*2.0*PI)); }
+	else if (value<0.625) { *x=0.5-(0.5*tan((value-0.5)*2.0*PI)); *y=1.0; }
+	else { *x=0.0; *y=0.5-(0.5*tan((value-0.75)*2.0*PI)); }
+}
+
+/* add the path of the timer wedge between the values from and to in the rectangle */
+void key_timer_path(cairo_t *cairoctx, gdouble x, gdouble y, gdouble w, gdouble h,
+	gdouble from, gdouble to)
+{
+	START_FUNC
+	gdouble px, py;
+	guint i;
+	cairo_move_to(cairoctx, x+(w/2.0), y+(h/2.0));
+	key_timer_point(from, &px, &py);
+	cairo_line_to(cairoctx, x+(px*w), y+(py*h));
+	for (i=0; i<G_N_ELEMENTS(key_timer_corners); i++) {
+		if (key_timer_corners[i][0]>from && key_timer_corners[i][0]<to)
+			cairo_line_to(cairoctx, x+(key_timer_corners[i][1]*w), y+(key_timer_corners[i][2]*h));
+	}
+	key_timer_point(to, &px, &py);
+	cairo_line_to(cairoctx, x+(px*w), y+(py*h));
+	cairo_close_path(cairoctx);
+	END_FUNC
+}
+
+/* get the extents of the timer wedge between the values from and to,
+ * relative to the size of the key (between 0 and 1) */
+void key_timer_extents(gdouble from, gdouble to, gdouble *x1, gdouble *y1, gdouble *x2, gdouble *y2)
+{
+	START_FUNC
+	gdouble px, py;
+	guint i;
+	*x1=*x2=*y1=*y2=0.5;
+	key_timer_point(from, &px, &py);
+	*x1=MIN(*x1, px); *x2=MAX(*x2, px); *y1=MIN(*y1, py); *y2=MAX(*y2, py);
+	key_timer_point(to, &px, &py);
+	*x1=MIN(*x1, px); *x2=MAX(*x2, px); *y1=MIN(*y1, py); *y2=MAX(*y2, py);
+	for (i=0; i<G_N_ELEMENTS(key_timer_corners); i++) {
+		if (key_timer_corners[i][0]>from && key_timer_corners[i][0]<to) {
+			*x1=MIN(*x1, key_timer_corners[i][1]); *x2=MAX(*x2, key_timer_corners[i][1]);
+			*y1=MIN(*y1, key_timer_corners[i][2]); *y2=MAX(*y2, key_timer_corners[i][2]);
+		}
+	}
+	END_FUNC
+}
+
 /* Draw the representation of the auto-click timer on the key
  * value is between 0 and 1 */
 void key_timer_draw(struct key *key, struct style *style, cairo_t *cairoctx, double value)
 {
 	START_FUNC
 	cairo_save(cairoctx);
-	style_cairo_set_color(cairoctx, STYLE_MOUSE_OVER_COLOR);
-	cairo_move_to(cairoctx, key->w/2.0, key->h/2.0);
-	cairo_line_to(cairoctx, key->w/2.0, 0.0);
-	if (value>0.125) cairo_line_to(cairoctx, key->w, 0.0);
-	if (value>0.375) cairo_line_to(cairoctx, key->w, key->h);
-	if (value>0.625) cairo_line_to(cairoctx, 0.0, key->h);
-	if (value>0.875) cairo_line_to(cairoctx, 0.0, 0.0);
-	if (value<0.125 || value>0.875) cairo_line_to(cairoctx, key->w/2+(key->w/2*tan(value*2.0*PI)), 0.0);
-	else if (value>0.125 && value<0.375) cairo_line_to(cairoctx, key->w, key->h/2+(key->h/2*tan((value-0.25)*2.0*PI)));
-	else if (value>0.375 && value<0.625) cairo_line_to(cairoctx, key->w/2-(key->w/2*tan((value-0.5)*2.0*PI)), key->h);
-	else if (value>0.625 && value<0.875) cairo_line_to(cairoctx, 0.0, key->h/2-(key->h/2*tan((value-0.75)*2.0*PI)));
-	cairo_close_path(cairoctx);
+	key_timer_path(cairoctx, 0.0, 0.0, key->w, key->h, 0.0, value);
 	cairo_clip(cairoctx);
 	style_shape_draw(style, key->shape, cairoctx, key->w, key->h, STYLE_MOUSE_OVER_COLOR);
 	cairo_restore(cairoctx);
@@ -408,13 +497,14 @@ void key_shape_draw(struct key *key, struct style *style, cairo_t *cairoctx)
 	END_FUNC
 }
 
-/* Draw the symbol of the key to the cairo surface. The symbol drawn on the key depends on the modifier */
-void key_symbol_draw(struct key *key, struct style *style,
-	cairo_t *cairoctx, struct status *status, gboolean use_matrix)
+/* Draw the symbol of the key for the global modifiers globalmod to the cairo surface. */
+void key_symbol_mod_draw(struct key *key, struct style *style, cairo_t *cairoctx,
+	struct status *status, GdkModifierType globalmod, guint group, gboolean use_matrix)
 {
 	START_FUNC
-	struct key_mod *mod=key_mod_find(key, status_globalmod_get(status));
+	struct key_mod *mod=key_mod_find(key, globalmod);
 	struct key_action *action;
+	gchar *name;
 
 	if (!use_matrix) {
 		cairo_save(cairoctx);
@@ -424,17 +514,16 @@ void key_symbol_draw(struct key *key, struct style *style,
 	switch (mod->type) {
 		case KEY_CODE:
 			style_symbol_draw(style, cairoctx,
-				xkeyboard_getKeyval(status->xkeyboard,
-					((struct key_code *)mod->data)->code,
-					status_globalmod_get(status)),
+				xkeyboard_group_keyval_get(status->xkeyboard,
+					((struct key_code *)mod->data)->code, globalmod, group),
 				key->w, key->h);
 			break;
 		case KEY_ACTION:
 			action=(struct key_action *)mod->data;
-			if (action->type==KEY_SWITCH)
-				style_draw_text(style, cairoctx,
-					xkeyboard_next_layout_get(status->xkeyboard), key->w, key->h);
-			else
+			if (action->type==KEY_SWITCH) {
+				if ((name=xkeyboard_group_next_layout_get(status->xkeyboard, group)))
+					style_draw_text(style, cairoctx, name, key->w, key->h);
+			} else
 				style_symbol_type_draw(style, cairoctx, action->type, key->w, key->h);
 			break;
 		default: flo_warn(_("unknown key type to draw."));
@@ -443,15 +532,23 @@ void key_symbol_draw(struct key *key, struct style *style,
 	END_FUNC
 }
 
-/* Draw the focus notifier to the cairo surface. */
-void key_focus_draw(struct key *key, struct style *style, cairo_t *cairoctx,
-	gdouble width, gdouble height, struct status *status)
+/* Draw the symbol of the key to the cairo surface. The symbol drawn on the key depends on the modifier */
+void key_symbol_draw(struct key *key, struct style *style,
+	cairo_t *cairoctx, struct status *status, gboolean use_matrix)
+{
+	START_FUNC
+	key_symbol_mod_draw(key, style, cairoctx, status, status_globalmod_get(status),
+		xkeyboard_group_get(status->xkeyboard), use_matrix);
+	END_FUNC
+}
+
+/* Move the cairo context to the focused key: zoom it and keep it inside the window */
+void key_focus_transform(struct key *key, cairo_t *cairoctx, gdouble width, gdouble height,
+	struct status *status)
 {
 	START_FUNC
-	enum style_colours color;
 	cairo_matrix_t matrix;
 	gdouble focus_zoom=status_focus_zoom_get(status)?settings_get_double(SETTINGS_FOCUS_ZOOM):1.0;
-	cairo_save(cairoctx);
 	cairo_translate(cairoctx, key->x-(key->w*focus_zoom/2.0), key->y-(key->h*focus_zoom/2.0));
 	cairo_scale(cairoctx, focus_zoom, focus_zoom);
 
@@ -462,8 +559,14 @@ void key_focus_draw(struct key *key, struct style *style, cairo_t *cairoctx,
 	if (((matrix.yy*key->h)+matrix.y0)>height) matrix.y0=height-(matrix.yy*key->h);
 	else if (matrix.y0<0.0) matrix.y0=0.0;
 	cairo_set_matrix(cairoctx, &matrix);
+	END_FUNC
+}
 
-	/* determine the color of th key */
+/* get the color of the key for its state */
+enum style_colours key_color_get(struct key *key)
+{
+	START_FUNC
+	enum style_colours color;
 	switch (key->state) {
 		case KEY_LOCKED:
 		case KEY_PRESSED: color=STYLE_ACTIVATED_COLOR; break;
@@ -472,7 +575,28 @@ void key_focus_draw(struct key *key, struct style *style, cairo_t *cairoctx,
 		default: flo_warn(_("unknown key type: %d"), key->state);
 			 color=STYLE_KEY_COLOR; break;
 	}
+	END_FUNC
+	return color;
+}
+
+/* Draw the shape of the key in the color and its symbol at the origin of the cairo context */
+void key_layer_draw(struct key *key, struct style *style, cairo_t *cairoctx,
+	struct status *status, enum style_colours color)
+{
+	START_FUNC
+	style_shape_draw(style, key->shape, cairoctx, key->w, key->h, color);
+	key_symbol_draw(key, style, cairoctx, status, TRUE);
+	END_FUNC
+}
 
+/* Draw the focus notifier to the cairo surface. */
+void key_focus_draw(struct key *key, struct style *style, cairo_t *cairoctx,
+	gdouble width, gdouble height, struct status *status)
+{
+	START_FUNC
+	enum style_colours color=key_color_get(key);
+	cairo_save(cairoctx);
+	key_focus_transform(key, cairoctx, width, height, status);
 	if (status_timer_get(status)>0.0) {
 		style_shape_draw(style, key->shape, cairoctx, key->w, key->h, color);
 		key_timer_draw(key, style, cairoctx, status_timer_get(status));
@@ -546,6 +670,15 @@ gboolean key_hit(struct key *key, gint x, gint y, gdouble zx, gdouble zy)
 #endif
 }
 
+/* compute the hit mask of the key at the scale in advance */
+void key_mask_prepare(struct key *key, gdouble zx, gdouble zy)
+{
+	START_FUNC
+	/* same size as key_hit */
+	style_shape_mask_prepare(key->shape, key->w*zx, key->h*zy);
+	END_FUNC
+}
+
 /* return the action type for the key and the status globalmod */
 enum key_action_type key_get_action(struct key *key, struct status *status) {
 	START_FUNC
@@ -33,6 +33,7 @@
 #include "xkeyboard.h"
 
 struct status;
+enum style_colours;
 
 /* Keys can be of the following types */
 enum key_type {
@@ -52,7 +53,8 @@ enum key_action_type {
 	KEY_EXTEND, /* argument = extension name */
 	KEY_UNEXTEND, /* argument = extension name */
 	KEY_UNKNOWN, /* unknown action */
-	KEY_NOP /* no action */
+	KEY_NOP, /* no action */
+	KEY_ACTION_TYPE_NUM
 };
 
 /* the key state, used in the FSM table */
@@ -104,6 +106,7 @@ struct key {
 	gdouble w, h; /* size of the key inside the keyboard */
 	void *keyboard; /* keyboard attached to the key */
 	enum key_state state; /* state of the key (pressed, released, latched or locked) */
+	GdkModifierType sensitivity; /* modifiers that change the symbol of the key */
 };
 
 /* Instanciate a key
@@ -111,6 +114,8 @@ struct key {
 struct key *key_new(struct layout *layout, struct style *style, struct xkeyboard *xkeyboard, void *keyboard);
 /* deallocate memory used by the key */
 void key_free(struct key *key);
+/* find the modifiers that change the symbol drawn on the key */
+GdkModifierType key_sensitivity_get(struct key *key, struct xkeyboard *xkeyboard);
 
 /* Send SPI events coresponding to the key */
 void key_press(struct key *key, struct status *status);
@@ -118,9 +123,26 @@ void key_release(struct key *key, struct status *status);
 
 /* Draw the shape of the key to the cairo surface. */
 void key_shape_draw(struct key *key, struct style *style, cairo_t *cairoctx);
+/* Draw the symbol of the key for the global modifiers globalmod and the xkb group to the cairo surface. */
+void key_symbol_mod_draw(struct key *key, struct style *style, cairo_t *cairoctx,
+	struct status *status, GdkModifierType globalmod, guint group, gboolean use_matrix);
 /* Draw the symbol of the key to the cairo surface. The symbol drawn on the key depends on the modifier */
 void key_symbol_draw(struct key *key, struct style *style,
 	cairo_t *cairoctx, struct status *status, gboolean use_matrix);
+/* Move the cairo context to the focused key: zoom it and keep it inside the window */
+void key_focus_transform(struct key *key, cairo_t *cairoctx, gdouble width, gdouble height,
+	struct status *status);
+/* get the color of the key for its state */
+enum style_colours key_color_get(struct key *key);
+/* Draw the shape of the key in the color and its symbol at the origin of the cairo context */
+void key_layer_draw(struct key *key, struct style *style, cairo_t *cairoctx,
+	struct status *status, enum style_colours color);
+/* add the path of the timer wedge between the values from and to in the rectangle */
+void key_timer_path(cairo_t *cairoctx, gdouble x, gdouble y, gdouble w, gdouble h,
+	gdouble from, gdouble to);
+/* get the extents of the timer wedge between the values from and to,
+ * relative to the size of the key (between 0 and 1) */
+void key_timer_extents(gdouble from, gdouble to, gdouble *x1, gdouble *y1, gdouble *x2, gdouble *y2);
 /* Draw the focus notifier to the cairo surface. */
 void key_focus_draw(struct key *key, struct style *style, cairo_t *cairoctx,
 	gdouble width, gdouble height, struct status *status);
@@ -139,6 +161,8 @@ enum key_hit key_hit(struct key *key, gint x, gint y, gdouble zx, gdouble zy);
 #else
 gboolean key_hit(struct key *key, gint x, gint y, gdouble zx, gdouble zy);
 #endif
+/* compute the hit mask of the key at the scale in advance */
+void key_mask_prepare(struct key *key, gdouble zx, gdouble zy);
 /* Parse string into key type enumeration */
 enum key_action_type key_action_type_get(gchar *str);
 /* return the action type for the key and the status globalmod */
@@ -153,6 +153,20 @@ struct keyboard *keyboard_extension_new (struct layout *layout, struct keyboard_
 	return keyboard;
 }
 
+/* recompute the modifiers that change the symbols of the keys (after a key map change) */
+void keyboard_sensitivity_update(struct keyboard *keyboard, struct xkeyboard *xkeyboard)
+{
+	START_FUNC
+	GSList *list=keyboard->keys;
+	struct key *key;
+	while (list) {
+		key=(struct key *)list->data;
+		key->sensitivity=key_sensitivity_get(key, xkeyboard);
+		list=list->next;
+	}
+	END_FUNC
+}
+
 /* delete a key from the keyboard */
 void keyboard_key_free (gpointer data, gpointer userdata)
 {
@@ -162,11 +176,78 @@ void keyboard_key_free (gpointer data, gpointer userdata)
 	END_FUNC
 }
 
+/* liberate the memory used by the grid */
+void keyboard_grid_free(struct keyboard *keyboard)
+{
+	START_FUNC
+	guint i;
+	if (keyboard->grid.cells) {
+		for (i=0; i<keyboard->grid.cols*keyboard->grid.rows; i++)
+			g_slist_free(keyboard->grid.cells[i]);
+		g_free(keyboard->grid.cells);
+	}
+	memset(&(keyboard->grid), 0, sizeof(struct keyboard_grid));
+	END_FUNC
+}
+
+/* build the grid of the keys for the scale */
+void keyboard_grid_update(struct keyboard *keyboard, gdouble zx, gdouble zy)
+{
+	START_FUNC
+	GSList *list;
+	struct key *key;
+	gint x1, y1, x2, y2, col, row;
+	guint i;
+
+	if (keyboard->grid.cells && (keyboard->grid.zx==zx) && (keyboard->grid.zy==zy)) return;
+	keyboard_grid_free(keyboard);
+	keyboard->grid.zx=zx;
+	keyboard->grid.zy=zy;
+	keyboard->grid.cols=((guint)(keyboard->width*zx)/KEYBOARD_GRID_CELL)+1;
+	keyboard->grid.rows=((guint)(keyboard->height*zy)/KEYBOARD_GRID_CELL)+1;
+	keyboard->grid.cells=g_malloc(sizeof(GSList *)*keyboard->grid.cols*keyboard->grid.rows);
+	memset(keyboard->grid.cells, 0, sizeof(GSList *)*keyboard->grid.cols*keyboard->grid.rows);
+
+	list=keyboard->keys;
+	while (list) {
+		key=(struct key *)list->data;
+		/* same rectangle as key_hit */
+		x1=zx*(key->x-(key->w/2.0));
+		y1=zy*(key->y-(key->h/2.0));
+		x2=x1+(zx*key->w);
+		y2=y1+(zy*key->h);
+		x1=CLAMP(x1/KEYBOARD_GRID_CELL, 0, (gint)keyboard->grid.cols-1);
+		y1=CLAMP(y1/KEYBOARD_GRID_CELL, 0, (gint)keyboard->grid.rows-1);
+		x2=CLAMP(x2/KEYBOARD_GRID_CELL, 0, (gint)keyboard->grid.cols-1);
+		y2=CLAMP(y2/KEYBOARD_GRID_CELL, 0, (gint)keyboard->grid.rows-1);
+		for (row=y1; row<=y2; row++) for (col=x1; col<=x2; col++)
+			keyboard->grid.cells[(row*keyboard->grid.cols)+col]=
+				g_slist_prepend(keyboard->grid.cells[(row*keyboard->grid.cols)+col], key);
+		list=list->next;
+	}
+	for (i=0; i<keyboard->grid.cols*keyboard->grid.rows; i++)
+		keyboard->grid.cells[i]=g_slist_reverse(keyboard->grid.cells[i]);
+	END_FUNC
+}
+
+/* compute the hit masks of the keys for the scale */
+void keyboard_masks_prepare(struct keyboard *keyboard, gdouble zx, gdouble zy)
+{
+	START_FUNC
+	GSList *list=keyboard->keys;
+	while (list) {
+		key_mask_prepare((struct key *)list->data, zx, zy);
+		list=list->next;
+	}
+	END_FUNC
+}
+
 /* delete a keyboard */
 void keyboard_free (struct keyboard *keyboard)
 {
 	START_FUNC
 	if (keyboard) {
+		keyboard_grid_free(keyboard);
 		g_slist_foreach(keyboard->keys, keyboard_key_free, NULL);
 		g_slist_free(keyboard->keys);
 		if (keyboard->name) g_free(keyboard->name);
@@ -202,8 +283,8 @@ void keyboard_set_over(struct keyboard *keyboard)
 }
 
 /* draw the keyboard to cairo surface */
-void keyboard_draw (struct keyboard *keyboard, cairo_t *cairoctx,
-	struct style *style, struct status *status, enum style_class class)
+void keyboard_draw (struct keyboard *keyboard, cairo_t *cairoctx, struct style *style,
+	struct status *status, GdkModifierType globalmod, guint group, enum style_class class)
 {
 	START_FUNC
 	GSList *list=keyboard->keys;
@@ -215,10 +296,12 @@ void keyboard_draw (struct keyboard *keyboard, cairo_t *cairoctx,
 		switch(class) {
 			case STYLE_SHAPE:
 				key_shape_draw((struct key *)list->data, style, cairoctx);
-				if (keyboard->under) key_symbol_draw((struct key *)list->data, style, cairoctx, status, FALSE);
+				if (keyboard->under) key_symbol_mod_draw((struct key *)list->data, style, cairoctx,
+					status, globalmod, group, FALSE);
 				break;
 			case STYLE_SYMBOL:
-				key_symbol_draw((struct key *)list->data, style, cairoctx, status, FALSE);
+				key_symbol_mod_draw((struct key *)list->data, style, cairoctx, status,
+					globalmod, group, FALSE);
 				break;
 		}
 		list = list->next;
@@ -231,15 +314,50 @@ void keyboard_draw (struct keyboard *keyboard, cairo_t *cairoctx,
 void keyboard_background_draw (struct keyboard *keyboard, cairo_t *cairoctx, struct style *style, struct status *status)
 {
 	START_FUNC
-	keyboard_draw(keyboard, cairoctx, style, status, STYLE_SHAPE);
+	keyboard_draw(keyboard, cairoctx, style, status, status_globalmod_get(status),
+		xkeyboard_group_get(status->xkeyboard), STYLE_SHAPE);
 	END_FUNC
 }
 
-/* draw the keyboard symbols  to cairo surface */
-void keyboard_symbols_draw (struct keyboard *keyboard, cairo_t *cairoctx, struct style *style, struct status *status)
+/* draw the keyboard symbols for the global modifiers to cairo surface */
+void keyboard_symbols_draw (struct keyboard *keyboard, cairo_t *cairoctx, struct style *style,
+	struct status *status, GdkModifierType globalmod, guint group)
 {
 	START_FUNC
-	keyboard_draw(keyboard, cairoctx, style, status, STYLE_SYMBOL);
+	keyboard_draw(keyboard, cairoctx, style, status, globalmod, group, STYLE_SYMBOL);
+	END_FUNC
+}
+
+/* redraw the symbols of the keys sensitive to the changed modifiers
+ * and add the rectangles of these keys to the damage region.
+ * When cairoctx is NULL, only the damage region is updated. */
+void keyboard_symbols_update (struct keyboard *keyboard, cairo_t *cairoctx, struct style *style,
+	struct status *status, GdkModifierType changed, cairo_region_t *damage)
+{
+	START_FUNC
+	GSList *list=keyboard->keys;
+	struct key *key;
+	if (keyboard->under) return;
+	while (list)
+	{
+		key=(struct key *)list->data;
+		if (key->sensitivity&changed) {
+			if (cairoctx) {
+				cairo_save(cairoctx);
+				cairo_translate(cairoctx, keyboard->xpos+key->x-(key->w/2.0),
+					keyboard->ypos+key->y-(key->h/2.0));
+				cairo_rectangle(cairoctx, 0.0, 0.0, key->w, key->h);
+				cairo_clip(cairoctx);
+				cairo_set_operator(cairoctx, CAIRO_OPERATOR_CLEAR);
+				cairo_paint(cairoctx);
+				cairo_set_operator(cairoctx, CAIRO_OPERATOR_OVER);
+				key_symbol_draw(key, style, cairoctx, status, TRUE);
+				cairo_restore(cairoctx);
+			}
+			cairo_region_union_rectangle(damage, keyboard_key_getrect(keyboard, key, FALSE));
+		}
+		list = list->next;
+	}
 	END_FUNC
 }
 
@@ -255,6 +373,16 @@ void keyboard_focus_draw (struct keyboard *keyboard, cairo_t *cairoctx, gdouble
 	END_FUNC
 }
 
+/* move the cairo context to the focused key of the keyboard */
+void keyboard_focus_transform (struct keyboard *keyboard, cairo_t *cairoctx, gdouble w, gdouble h,
+	struct key *key, struct status *status)
+{
+	START_FUNC
+	cairo_translate(cairoctx, keyboard->xpos, keyboard->ypos);
+	key_focus_transform(key, cairoctx, w, h, status);
+	END_FUNC
+}
+
 /* draw the pressed indicator on a key */
 void keyboard_press_draw (struct keyboard *keyboard, cairo_t *cairoctx,
 	struct style *style, struct key *key, struct status *status)
@@ -282,21 +410,23 @@ GdkRectangle *keyboard_key_getrect(struct keyboard *keyboard, struct key *key, g
 	START_FUNC
 	static GdkRectangle rect;
 	gdouble x, y, w, h, xmargin, ymargin;
+	gdouble scalex=settings_get_double(SETTINGS_SCALEX);
+	gdouble scaley=settings_get_double(SETTINGS_SCALEY);
 	x=keyboard->xpos+(key->x-(key->w/2.0));
 	y=keyboard->ypos+(key->y-(key->h/2.0));
 	w=key->w;
 	h=key->h;
 	if (focus_zoom) {
-		xmargin=(w*settings_get_double(SETTINGS_SCALEX)*(settings_get_double(SETTINGS_FOCUS_ZOOM)-1.0))+5.0;
-		ymargin=(h*settings_get_double(SETTINGS_SCALEY)*(settings_get_double(SETTINGS_FOCUS_ZOOM)-1.0))+5.0;
+		xmargin=(w*scalex*(settings_get_double(SETTINGS_FOCUS_ZOOM)-1.0))+5.0;
+		ymargin=(h*scaley*(settings_get_double(SETTINGS_FOCUS_ZOOM)-1.0))+5.0;
 	} else {
 		xmargin=5.0;
 		ymargin=5.0;
 	}
-	rect.x=(x*settings_get_double(SETTINGS_SCALEX))-xmargin;
-	rect.y=(y*settings_get_double(SETTINGS_SCALEY))-ymargin;
-	rect.width=(w*settings_get_double(SETTINGS_SCALEX))+(xmargin*2);
-	rect.height=(h*settings_get_double(SETTINGS_SCALEY))+(ymargin*2);
+	rect.x=(x*scalex)-xmargin;
+	rect.y=(y*scaley)-ymargin;
+	rect.width=(w*scalex)+(xmargin*2);
+	rect.height=(h*scaley)+(ymargin*2);
 	END_FUNC
 	return &rect;
 }
@@ -311,9 +441,14 @@ struct key *keyboard_hit_get(struct keyboard *keyboard, gint x, gint y, gdouble
 	START_FUNC
 	GSList *list=keyboard->keys;
 #ifdef ENABLE_RAMBLE
-	enum key_hit kh;
+	enum key_hit kh=KEY_MISS;
 #endif
 	if (keyboard->under) return NULL;
+	/* only test the keys of the grid cell (outside the grid, test every key) */
+	keyboard_grid_update(keyboard, zx, zy);
+	if ((x>=0) && (y>=0) && ((x/KEYBOARD_GRID_CELL)<keyboard->grid.cols) &&
+		((y/KEYBOARD_GRID_CELL)<keyboard->grid.rows))
+		list=keyboard->grid.cells[((y/KEYBOARD_GRID_CELL)*keyboard->grid.cols)+(x/KEYBOARD_GRID_CELL)];
 	while (list &&
 #ifdef ENABLE_RAMBLE
 		(!(kh=key_hit((struct key *)list->data, x, y, zx, zy))))
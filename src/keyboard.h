@@ -36,6 +36,17 @@ struct keyboard_trigger {
 	struct key *key;
 };
 
+/* size of the cells of the grid in pixels */
+#define KEYBOARD_GRID_CELL 32
+
+/* Uniform grid of the keys in pixels, to find the keys at a position.
+ * Each cell lists the keys whose rectangle overlaps it, in the keyboard order */
+struct keyboard_grid {
+	gdouble zx, zy; /* scale of the grid */
+	guint cols, rows; /* number of cells */
+	GSList **cells; /* keys by cell */
+};
+
 /* A keyboard is a set of keys logically grouped together */
 /* Examples: the main keyboard, the numpad or the function keys */
 struct keyboard {
@@ -48,6 +59,7 @@ struct keyboard {
 	GSList *keys; /* list of the keys of the keyboard */
 	gboolean activated; /* true when the extension is activated */
 	struct keyboard_trigger *onhide; /* action triggered on hiding the keyboard */
+	struct keyboard_grid grid; /* keys by position in pixels */
 };
 
 /* This structure contains data from hardware keyboard as well as global florence data
@@ -81,6 +93,12 @@ struct key *keyboard_hit_get(struct keyboard *keyboard, gint x, gint y,
 #else
 struct key *keyboard_hit_get(struct keyboard *keyboard, gint x, gint y, gdouble zx, gdouble zy);
 #endif
+/* recompute the modifiers that change the symbols of the keys (after a key map change) */
+void keyboard_sensitivity_update(struct keyboard *keyboard, struct xkeyboard *xkeyboard);
+/* compute the hit masks of the keys for the scale */
+void keyboard_masks_prepare(struct keyboard *keyboard, gdouble zx, gdouble zy);
+/* build the grid of the keys for the scale (done on first hit test otherwise) */
+void keyboard_grid_update(struct keyboard *keyboard, gdouble zx, gdouble zy);
 /* returns a rectangle containing the key */
 /* WARNING: not thread safe */
 GdkRectangle *keyboard_key_getrect(struct keyboard *keyboard, struct key *key, gboolean focus_zoom);
@@ -94,12 +112,20 @@ void keyboard_set_over(struct keyboard *keyboard);
 /* draw the keyboard background to cairo surface */
 void keyboard_background_draw (struct keyboard *keyboard, cairo_t *cairoctx,
 	struct style *style, struct status *status);
-/* draw the keyboard symbols  to cairo surface */
+/* draw the keyboard symbols for the global modifiers and the xkb group to cairo surface */
 void keyboard_symbols_draw (struct keyboard *keyboard, cairo_t *cairoctx,
-	struct style *style, struct status *status);
+	struct style *style, struct status *status, GdkModifierType globalmod, guint group);
+/* redraw the symbols of the keys sensitive to the changed modifiers
+ * and add the rectangles of these keys to the damage region.
+ * When cairoctx is NULL, only the damage region is updated. */
+void keyboard_symbols_update (struct keyboard *keyboard, cairo_t *cairoctx, struct style *style,
+	struct status *status, GdkModifierType changed, cairo_region_t *damage);
 /* draw the focus indicator on a key */
 void keyboard_focus_draw (struct keyboard *keyboard, cairo_t *cairoctx, gdouble w, gdouble h,
 	struct style *style, struct key *key, struct status *status);
+/* move the cairo context to the focused key of the keyboard */
+void keyboard_focus_transform (struct keyboard *keyboard, cairo_t *cairoctx, gdouble w, gdouble h,
+	struct key *key, struct status *status);
 /* draw the pressed indicator on a key */
 void keyboard_press_draw (struct keyboard *keyboard, cairo_t *cairoctx,
 	struct style *style, struct key *key, struct status *status);
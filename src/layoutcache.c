@@ -0,0 +1,599 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#include "system.h"
+#include "trace.h"
+#include "layoutcache.h"
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <libxml/xmlIO.h>
+
+/* bump when the format of the cache files changes */
+#define LAYOUTCACHE_VERSION 1
+#define LAYOUTCACHE_MAGIC "FLOC"
+/* number of content hashes kept in the known good list */
+#define LAYOUTCACHE_KNOWN_MAX 32
+
+/* kinds of the compiled nodes */
+enum layoutcache_kind {
+	LAYOUTCACHE_ELEMENT=1,
+	LAYOUTCACHE_TEXT,
+	LAYOUTCACHE_CDATA
+};
+
+/* a file read to build a document */
+struct layoutcache_file {
+	gchar *path;
+	gint64 mtime;
+	gint64 size;
+	gchar *hash; /* sha1 of the content */
+};
+
+/* cursor in a mapped cache file */
+struct layoutcache_reader {
+	const gchar *data;
+	gsize size;
+	gsize pos;
+	gboolean error;
+};
+
+/* files read since layoutcache_record_start (or NULL when not recording) */
+static GSList *layoutcache_files=NULL;
+static gboolean layoutcache_recording=FALSE;
+
+/* return the absolute path of a file name or a file URI read by libxml */
+static gchar *layoutcache_path_absolute(const gchar *name)
+{
+	START_FUNC
+	gchar *cwd, *ret;
+	if (g_str_has_prefix(name, "file:")) {
+		ret=g_filename_from_uri(name, NULL, NULL);
+		END_FUNC
+		return ret;
+	}
+	if (g_path_is_absolute(name)) {
+		END_FUNC
+		return g_strdup(name);
+	}
+	cwd=g_get_current_dir();
+	ret=g_build_filename(cwd, name, NULL);
+	g_free(cwd);
+	END_FUNC
+	return ret;
+}
+
+/* libxml input match callback: records the files opened and lets the default callbacks open them */
+static int layoutcache_match(char const *filename)
+{
+	START_FUNC
+	gchar *path;
+	if (layoutcache_recording && filename) {
+		path=layoutcache_path_absolute(filename);
+		if (path && !g_slist_find_custom(layoutcache_files, path, (GCompareFunc)strcmp))
+			layoutcache_files=g_slist_append(layoutcache_files, path);
+		else g_free(path);
+	}
+	END_FUNC
+	return 0;
+}
+
+/* start recording the files read by libxml to build a document */
+void layoutcache_record_start(void)
+{
+	START_FUNC
+	static gboolean registered=FALSE;
+	if (!registered) {
+		/* the default callbacks must be registered first to be tried after ours */
+		xmlInitParser();
+		if (xmlRegisterInputCallbacks(layoutcache_match, NULL, NULL, NULL)<0)
+			flo_warn(_("Unable to record the files of the layout: the layout won't be cached"));
+		registered=TRUE;
+	}
+	layoutcache_record_free(layoutcache_files);
+	layoutcache_files=NULL;
+	layoutcache_recording=TRUE;
+	END_FUNC
+}
+
+/* stop recording and return the list of files read */
+GSList *layoutcache_record_stop(void)
+{
+	START_FUNC
+	GSList *ret=layoutcache_files;
+	layoutcache_files=NULL;
+	layoutcache_recording=FALSE;
+	END_FUNC
+	return ret;
+}
+
+/* free a list of recorded files */
+void layoutcache_record_free(GSList *files)
+{
+	START_FUNC
+	g_slist_free_full(files, g_free);
+	END_FUNC
+}
+
+/* return the sha1 of the content of a file or NULL */
+static gchar *layoutcache_hash(const gchar *path)
+{
+	START_FUNC
+	gchar *content, *ret;
+	gsize length;
+	if (!g_file_get_contents(path, &content, &length, NULL)) {
+		END_FUNC
+		return NULL;
+	}
+	ret=g_compute_checksum_for_data(G_CHECKSUM_SHA1, (guchar *)content, length);
+	g_free(content);
+	END_FUNC
+	return ret;
+}
+
+/* return the name of the cache file of a layout file validated against relaxng */
+static gchar *layoutcache_filename(const gchar *file, const gchar *relaxng)
+{
+	START_FUNC
+	gchar *path=layoutcache_path_absolute(file);
+	gchar *key=g_strconcat(path, "\n", relaxng, NULL);
+	gchar *hash=g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+	gchar *name=g_strconcat(hash, ".layout", NULL);
+	gchar *ret=g_build_filename(g_get_user_cache_dir(), "florence", name, NULL);
+	g_free(name);
+	g_free(hash);
+	g_free(key);
+	g_free(path);
+	END_FUNC
+	return ret;
+}
+
+/* return the name of the known good list */
+static gchar *layoutcache_known_filename(void)
+{
+	START_FUNC
+	gchar *ret=g_build_filename(g_get_user_cache_dir(), "florence", "known-good", NULL);
+	END_FUNC
+	return ret;
+}
+
+/* return a hash of the content of the files and of the validation document */
+gchar *layoutcache_content_hash(GSList *files, const gchar *relaxng)
+{
+	START_FUNC
+	GChecksum *checksum=g_checksum_new(G_CHECKSUM_SHA1);
+	GSList *item;
+	gchar *hash, *ret=NULL;
+	gboolean ok=TRUE;
+	for (item=files;item && ok;item=item->next) {
+		if ((hash=layoutcache_hash((gchar *)item->data))) {
+			g_checksum_update(checksum, (guchar *)hash, -1);
+			g_free(hash);
+		} else ok=FALSE;
+	}
+	if (ok && (hash=layoutcache_hash(relaxng))) {
+		g_checksum_update(checksum, (guchar *)hash, -1);
+		g_free(hash);
+		ret=g_strdup(g_checksum_get_string(checksum));
+	}
+	g_checksum_free(checksum);
+	END_FUNC
+	return ret;
+}
+
+/* return TRUE when a content hash is in the list of the contents known to be valid */
+gboolean layoutcache_known(const gchar *hash)
+{
+	START_FUNC
+	gchar *filename=layoutcache_known_filename();
+	gchar *content=NULL;
+	gchar **lines, **line;
+	gboolean ret=FALSE;
+	if (hash && g_file_get_contents(filename, &content, NULL, NULL)) {
+		lines=g_strsplit(content, "\n", -1);
+		for (line=lines;*line && !ret;line++) ret=!strcmp(*line, hash);
+		g_strfreev(lines);
+		g_free(content);
+	}
+	g_free(filename);
+	END_FUNC
+	return ret;
+}
+
+/* add a content hash to the list of the contents known to be valid
+ * only the last LAYOUTCACHE_KNOWN_MAX hashes are kept */
+void layoutcache_known_add(const gchar *hash)
+{
+	START_FUNC
+	gchar *filename=layoutcache_known_filename();
+	gchar *dirname=g_path_get_dirname(filename);
+	gchar *content=NULL;
+	gchar **lines=NULL;
+	GString *list=g_string_new(NULL);
+	guint count, first=0, i;
+	if (g_file_get_contents(filename, &content, NULL, NULL)) {
+		lines=g_strsplit(content, "\n", -1);
+		count=g_strv_length(lines);
+		if (count>=LAYOUTCACHE_KNOWN_MAX) first=count-LAYOUTCACHE_KNOWN_MAX+1;
+		for (i=first;i<count;i++) {
+			if (lines[i][0]!='\0' && strcmp(lines[i], hash))
+				g_string_append_printf(list, "%s\n", lines[i]);
+		}
+	}
+	g_string_append_printf(list, "%s\n", hash);
+	if (g_mkdir_with_parents(dirname, 0700) ||
+		!g_file_set_contents(filename, list->str, list->len, NULL))
+		flo_warn(_("Unable to write the list of valid layouts %s"), filename);
+	g_string_free(list, TRUE);
+	g_strfreev(lines);
+	g_free(content);
+	g_free(dirname);
+	g_free(filename);
+	END_FUNC
+}
+
+/* read a 32 bits integer from the cache file */
+static guint32 layoutcache_u32(struct layoutcache_reader *reader)
+{
+	START_FUNC
+	guint32 ret=0;
+	if (reader->error || reader->size-reader->pos<sizeof(guint32)) reader->error=TRUE;
+	else {
+		memcpy(&ret, reader->data+reader->pos, sizeof(guint32));
+		reader->pos+=sizeof(guint32);
+	}
+	END_FUNC
+	return ret;
+}
+
+/* read a 64 bits integer from the cache file */
+static gint64 layoutcache_i64(struct layoutcache_reader *reader)
+{
+	START_FUNC
+	gint64 ret=0;
+	if (reader->error || reader->size-reader->pos<sizeof(gint64)) reader->error=TRUE;
+	else {
+		memcpy(&ret, reader->data+reader->pos, sizeof(gint64));
+		reader->pos+=sizeof(gint64);
+	}
+	END_FUNC
+	return ret;
+}
+
+/* return a string of the cache file (pointing to the mapped data) or NULL */
+static const gchar *layoutcache_string(struct layoutcache_reader *reader)
+{
+	START_FUNC
+	const gchar *ret=NULL;
+	guint32 length=layoutcache_u32(reader);
+	/* the strings are stored with their terminating nul */
+	if (reader->error || reader->size-reader->pos<=length || reader->data[reader->pos+length]!='\0')
+		reader->error=TRUE;
+	else {
+		ret=reader->data+reader->pos;
+		reader->pos+=length+1;
+	}
+	END_FUNC
+	return ret;
+}
+
+/* append a 32 bits integer to the cache data */
+static void layoutcache_u32_write(GByteArray *data, guint32 value)
+{
+	START_FUNC
+	g_byte_array_append(data, (guint8 *)&value, sizeof(guint32));
+	END_FUNC
+}
+
+/* append a 64 bits integer to the cache data */
+static void layoutcache_i64_write(GByteArray *data, gint64 value)
+{
+	START_FUNC
+	g_byte_array_append(data, (guint8 *)&value, sizeof(gint64));
+	END_FUNC
+}
+
+/* append a string to the cache data */
+static void layoutcache_string_write(GByteArray *data, const gchar *string)
+{
+	START_FUNC
+	guint32 length=string?strlen(string):0;
+	layoutcache_u32_write(data, length);
+	if (length) g_byte_array_append(data, (guint8 *)string, length);
+	g_byte_array_append(data, (guint8 *)"", 1);
+	END_FUNC
+}
+
+/* compile the children of a node into the cache data: count followed by the nodes
+ * the XInclude markers, the comments and the processing instructions are left out */
+static void layoutcache_children_write(GByteArray *data, xmlDocPtr doc, xmlNodePtr node)
+{
+	START_FUNC
+	xmlNodePtr cur;
+	xmlAttrPtr attr;
+	xmlNsPtr ns;
+	xmlChar *value;
+	guint offset=data->len;
+	guint32 count=0, attrs;
+	guint attrs_offset;
+	guint8 kind;
+
+	layoutcache_u32_write(data, 0);
+	for (cur=node;cur;cur=cur->next) {
+		switch (cur->type) {
+			case XML_ELEMENT_NODE:
+				kind=LAYOUTCACHE_ELEMENT;
+				g_byte_array_append(data, &kind, 1);
+				layoutcache_string_write(data, (gchar *)cur->name);
+				layoutcache_string_write(data, cur->ns?(gchar *)cur->ns->href:NULL);
+				attrs=0; attrs_offset=data->len;
+				layoutcache_u32_write(data, 0);
+				for (ns=cur->nsDef;ns;ns=ns->next) {
+					layoutcache_string_write(data, (gchar *)ns->prefix);
+					layoutcache_string_write(data, (gchar *)ns->href);
+					attrs++;
+				}
+				memcpy(data->data+attrs_offset, &attrs, sizeof(guint32));
+				attrs=0; attrs_offset=data->len;
+				layoutcache_u32_write(data, 0);
+				for (attr=cur->properties;attr;attr=attr->next) {
+					value=xmlNodeListGetString(doc, attr->children, 1);
+					layoutcache_string_write(data, (gchar *)attr->name);
+					layoutcache_string_write(data, attr->ns?(gchar *)attr->ns->href:NULL);
+					layoutcache_string_write(data, (gchar *)value);
+					if (value) xmlFree(value);
+					attrs++;
+				}
+				memcpy(data->data+attrs_offset, &attrs, sizeof(guint32));
+				layoutcache_children_write(data, doc, cur->children);
+				count++;
+				break;
+			case XML_TEXT_NODE:
+			case XML_CDATA_SECTION_NODE:
+			case XML_ENTITY_REF_NODE:
+				value=xmlNodeGetContent(cur);
+				kind=cur->type==XML_CDATA_SECTION_NODE?LAYOUTCACHE_CDATA:LAYOUTCACHE_TEXT;
+				g_byte_array_append(data, &kind, 1);
+				layoutcache_string_write(data, (gchar *)value);
+				if (value) xmlFree(value);
+				count++;
+				break;
+			default: break;
+		}
+	}
+	memcpy(data->data+offset, &count, sizeof(guint32));
+	END_FUNC
+}
+
+/* return the namespace of node for href (NULL for none) */
+static xmlNsPtr layoutcache_ns_get(xmlDocPtr doc, xmlNodePtr node, const gchar *href)
+{
+	START_FUNC
+	xmlNsPtr ret=NULL;
+	if (href[0]!='\0') {
+		ret=xmlSearchNsByHref(doc, node, (xmlChar *)href);
+		if (!ret) ret=xmlNewNs(node, (xmlChar *)href, NULL);
+	}
+	END_FUNC
+	return ret;
+}
+
+/* rebuild the children of parent from the cache data */
+static void layoutcache_children_read(struct layoutcache_reader *reader, xmlDocPtr doc, xmlNodePtr parent)
+{
+	START_FUNC
+	guint32 count=layoutcache_u32(reader);
+	guint32 i, j, n;
+	xmlNodePtr node;
+	const gchar *name, *href, *value;
+
+	for (i=0;(i<count) && !reader->error;i++) {
+		if (reader->pos>=reader->size) { reader->error=TRUE; break; }
+		switch (reader->data[reader->pos++]) {
+			case LAYOUTCACHE_ELEMENT:
+				name=layoutcache_string(reader);
+				href=layoutcache_string(reader);
+				if (reader->error) break;
+				node=xmlNewDocNode(doc, NULL, (xmlChar *)name, NULL);
+				xmlAddChild(parent, node);
+				n=layoutcache_u32(reader);
+				for (j=0;(j<n) && !reader->error;j++) {
+					name=layoutcache_string(reader);
+					value=layoutcache_string(reader);
+					if (!reader->error) xmlNewNs(node, (xmlChar *)value,
+						name[0]=='\0'?NULL:(xmlChar *)name);
+				}
+				if (reader->error) break;
+				xmlSetNs(node, layoutcache_ns_get(doc, node, href));
+				n=layoutcache_u32(reader);
+				for (j=0;(j<n) && !reader->error;j++) {
+					name=layoutcache_string(reader);
+					href=layoutcache_string(reader);
+					value=layoutcache_string(reader);
+					if (!reader->error) xmlNewNsProp(node, layoutcache_ns_get(doc, node, href),
+						(xmlChar *)name, (xmlChar *)value);
+				}
+				layoutcache_children_read(reader, doc, node);
+				break;
+			case LAYOUTCACHE_TEXT:
+				value=layoutcache_string(reader);
+				if (!reader->error) xmlAddChild(parent, xmlNewDocText(doc, (xmlChar *)value));
+				break;
+			case LAYOUTCACHE_CDATA:
+				value=layoutcache_string(reader);
+				if (!reader->error) xmlAddChild(parent,
+					xmlNewCDataBlock(doc, (xmlChar *)value, strlen(value)));
+				break;
+			default: reader->error=TRUE;
+		}
+	}
+	END_FUNC
+}
+
+/* check the files recorded in the cache header
+ * return FALSE when one of them has changed. Set touched when a file has a new mtime
+ * or size but the same content, and append the files to the list */
+static gboolean layoutcache_files_check(struct layoutcache_reader *reader, gboolean *touched, GSList **files)
+{
+	START_FUNC
+	guint32 count=layoutcache_u32(reader);
+	guint32 i;
+	const gchar *path, *hash;
+	gint64 mtime, size;
+	gchar *current;
+	GStatBuf stat;
+	gboolean ret=!reader->error;
+
+	for (i=0;(i<count) && ret;i++) {
+		path=layoutcache_string(reader);
+		mtime=layoutcache_i64(reader);
+		size=layoutcache_i64(reader);
+		hash=layoutcache_string(reader);
+		if (reader->error || g_stat(path, &stat)) ret=FALSE;
+		else if ((mtime!=(gint64)stat.st_mtime) || (size!=(gint64)stat.st_size)) {
+			current=layoutcache_hash(path);
+			if (current && !strcmp(current, hash)) *touched=TRUE;
+			else {
+				flo_debug(TRACE_DEBUG, _("Layout cache: %s has changed"), path);
+				ret=FALSE;
+			}
+			g_free(current);
+		}
+		if (ret) *files=g_slist_append(*files, g_strdup(path));
+	}
+	END_FUNC
+	return ret;
+}
+
+/* return the document compiled from file and validated against relaxng
+ * or NULL when there is no valid cache for it */
+xmlDocPtr layoutcache_load(const gchar *file, const gchar *relaxng)
+{
+	START_FUNC
+	gchar *filename=layoutcache_filename(file, relaxng);
+	GMappedFile *map=g_mapped_file_new(filename, FALSE, NULL);
+	struct layoutcache_reader reader;
+	xmlDocPtr doc=NULL;
+	gboolean touched=FALSE;
+	GSList *files=NULL;
+	const gchar *version;
+
+	if (!map) {
+		flo_debug(TRACE_DEBUG, _("Layout cache: no cache for %s"), file);
+		g_free(filename);
+		END_FUNC
+		return NULL;
+	}
+	memset(&reader, 0, sizeof(struct layoutcache_reader));
+	reader.data=g_mapped_file_get_contents(map);
+	reader.size=g_mapped_file_get_length(map);
+	if (reader.size<sizeof(LAYOUTCACHE_MAGIC) ||
+		memcmp(reader.data, LAYOUTCACHE_MAGIC, sizeof(LAYOUTCACHE_MAGIC))) {
+		reader.error=TRUE;
+	} else {
+		reader.pos=sizeof(LAYOUTCACHE_MAGIC);
+		if (layoutcache_u32(&reader)!=LAYOUTCACHE_VERSION) reader.error=TRUE;
+		version=layoutcache_string(&reader);
+		if (!reader.error && strcmp(version, VERSION)) reader.error=TRUE;
+	}
+	if (!reader.error && layoutcache_files_check(&reader, &touched, &files)) {
+		doc=xmlNewDoc((xmlChar *)"1.0");
+		doc->URL=xmlStrdup((xmlChar *)file);
+		layoutcache_children_read(&reader, doc, (xmlNodePtr)doc);
+		if (reader.error || !xmlDocGetRootElement(doc)) {
+			flo_warn(_("The layout cache file %s is corrupted"), filename);
+			xmlFreeDoc(doc);
+			doc=NULL;
+		} else {
+			flo_debug(TRACE_DEBUG, _("Layout cache: using %s for %s"), filename, file);
+			/* refresh the mtimes to avoid hashing the files on the next start */
+			if (touched) layoutcache_save(doc, file, relaxng, files);
+		}
+	}
+	layoutcache_record_free(files);
+	g_mapped_file_unref(map);
+	g_free(filename);
+	END_FUNC
+	return doc;
+}
+
+/* compile the validated document doc built from the files into the cache */
+void layoutcache_save(xmlDocPtr doc, const gchar *file, const gchar *relaxng, GSList *files)
+{
+	START_FUNC
+	gchar *filename=layoutcache_filename(file, relaxng);
+	gchar *dirname=g_path_get_dirname(filename);
+	GByteArray *data=g_byte_array_new();
+	GSList *list=g_slist_copy(files);
+	GSList *item;
+	gchar *hash, *rng=layoutcache_path_absolute(relaxng);
+	gchar *path=layoutcache_path_absolute(file);
+	GStatBuf stat;
+	guint32 count=0;
+	guint offset;
+	GError *error=NULL;
+	gboolean ok=TRUE;
+
+	/* the layout and the validation document are dependencies too */
+	if (!g_slist_find_custom(list, path, (GCompareFunc)strcmp))
+		list=g_slist_prepend(list, path);
+	if (!g_slist_find_custom(list, rng, (GCompareFunc)strcmp))
+		list=g_slist_append(list, rng);
+
+	g_byte_array_append(data, (guint8 *)LAYOUTCACHE_MAGIC, sizeof(LAYOUTCACHE_MAGIC));
+	layoutcache_u32_write(data, LAYOUTCACHE_VERSION);
+	layoutcache_string_write(data, VERSION);
+	offset=data->len;
+	layoutcache_u32_write(data, 0);
+	for (item=list;item && ok;item=item->next) {
+		if (g_stat((gchar *)item->data, &stat) || !(hash=layoutcache_hash((gchar *)item->data))) {
+			flo_debug(TRACE_DEBUG, _("Layout cache: %s can't be checked, %s won't be cached"),
+				(gchar *)item->data, file);
+			ok=FALSE;
+		} else {
+			layoutcache_string_write(data, (gchar *)item->data);
+			layoutcache_i64_write(data, (gint64)stat.st_mtime);
+			layoutcache_i64_write(data, (gint64)stat.st_size);
+			layoutcache_string_write(data, hash);
+			g_free(hash);
+			count++;
+		}
+	}
+	if (ok) {
+		memcpy(data->data+offset, &count, sizeof(guint32));
+		layoutcache_children_write(data, doc, doc->children);
+		if (g_mkdir_with_parents(dirname, 0700) ||
+			!g_file_set_contents(filename, (gchar *)data->data, data->len, &error)) {
+			flo_warn(_("Unable to write the layout cache %s: %s"), filename,
+				error?error->message:g_strerror(errno));
+			if (error) g_error_free(error);
+		} else flo_debug(TRACE_DEBUG, _("Layout cache: %s written for %s"), filename, file);
+	}
+
+	g_slist_free(list);
+	g_free(path);
+	g_free(rng);
+	g_byte_array_free(data, TRUE);
+	g_free(dirname);
+	g_free(filename);
+	END_FUNC
+}
+
@@ -0,0 +1,56 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#ifndef FLO_LAYOUTCACHE
+#define FLO_LAYOUTCACHE
+
+#include <glib.h>
+#include <libxml/tree.h>
+
+/* The layout cache keeps a compiled copy of the included and validated layout documents
+ * in $XDG_CACHE_HOME/florence, so the next start can skip the parsing, the XInclude
+ * processing and the Relax-NG validation.
+ * A cache file is keyed by the layout file and the validation document. It records the
+ * files read to build the document and is invalidated when one of them has changed:
+ * the mtime and size are checked first and the content hash only when they differ. */
+
+/* start recording the files read by libxml to build a document */
+void layoutcache_record_start(void);
+/* stop recording and return the list of files read (to free with layoutcache_record_free) */
+GSList *layoutcache_record_stop(void);
+/* free a list of recorded files */
+void layoutcache_record_free(GSList *files);
+
+/* return the document compiled from file and validated against relaxng
+ * or NULL when there is no valid cache for it */
+xmlDocPtr layoutcache_load(const gchar *file, const gchar *relaxng);
+/* compile the validated document doc built from the files into the cache */
+void layoutcache_save(xmlDocPtr doc, const gchar *file, const gchar *relaxng, GSList *files);
+
+/* return a hash of the content of the files and of the validation document */
+gchar *layoutcache_content_hash(GSList *files, const gchar *relaxng);
+/* return TRUE when a content hash is in the list of the contents known to be valid */
+gboolean layoutcache_known(const gchar *hash);
+/* add a content hash to the list of the contents known to be valid */
+void layoutcache_known_add(const gchar *hash);
+
+#endif
+
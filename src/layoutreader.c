@@ -26,9 +26,13 @@
 #include <libxml/xinclude.h>
 #include "system.h"
 #include "layoutreader.h"
+#include "layoutcache.h"
 #include "trace.h"
 #include "settings.h"
 
+/* compiled validation documents by file name */
+static GHashTable *layoutreader_schemas=NULL;
+
 /* Open a layout element */
 gboolean layoutreader_element_open(struct layout *layout, char *name)
 {
@@ -48,6 +52,29 @@ void layoutreader_element_close(struct layout *layout)
 	END_FUNC
 }
 
+/* Open the element at the cursor whatever its name and return its name (NULL at the end of the level) */
+const char *layoutreader_child_open(struct layout *layout)
+{
+	START_FUNC
+	const char *ret=NULL;
+	while (layout->cur && layout->cur->type!=XML_ELEMENT_NODE) layout->cur=layout->cur->next;
+	if ((layout->child=layout->cur)) {
+		ret=(const char *)layout->child->name;
+		layout->cur=layout->child->children;
+	}
+	END_FUNC
+	return ret;
+}
+
+/* Close the element opened by layoutreader_child_open and move to the next one */
+void layoutreader_child_close(struct layout *layout)
+{
+	START_FUNC
+	if (layout->child) layout->cur=layout->child->next;
+	layout->child=NULL;
+	END_FUNC
+}
+
 /* Reset layout cursor */
 void layoutreader_reset(struct layout *layout)
 {
@@ -222,15 +249,16 @@ struct layout_key *layoutreader_key_new(struct layout *layout, layout_modifier_c
 	struct layout_key *key=layoutreader_element_init(layout, "key", sizeof(struct layout_key));
 	struct layout_modifier *mod=g_malloc(sizeof(struct layout_modifier));
 	xmlAttrPtr attr;
-	struct layout_id *id;
+	xmlChar *id;
 
 	if (key) {
 		attr=xmlHasProp(layout->cur->parent, (xmlChar *)"id");
 		if (attr) {
-			id=g_malloc(sizeof(struct layout_id));
-			id->object=object;
-			id->name=(char *)xmlNodeListGetString(layout->doc, attr->children, 1);
-			layout->ids=g_slist_append(layout->ids, id);
+			id=xmlNodeListGetString(layout->doc, attr->children, 1);
+			/* the first node with an id is used */
+			if (id && !g_hash_table_lookup_extended(layout->ids, id, NULL, NULL))
+				g_hash_table_insert(layout->ids, id, object);
+			else if (id) xmlFree(id);
 		}
 		for(cur=layout->cur;cur;cur=cur->next) {
 			mod->action=NULL;
@@ -330,7 +358,7 @@ struct layout_trigger *layoutreader_trigger_new(struct layout *layout)
 {
 	START_FUNC
 	unsigned char *action, *argument;
-	GSList *list=layout->ids;
+	gpointer object;
 	xmlNodePtr cur=layout->cur;
 	struct layout_trigger *trigger=layoutreader_element_init(layout,
 		"onhide", sizeof(struct layout_trigger));
@@ -338,10 +366,8 @@ struct layout_trigger *layoutreader_trigger_new(struct layout *layout)
 		for(cur=layout->cur;cur;cur=cur->next) {
 			if (!xmlStrcmp(cur->name, (xmlChar *)"action")) {
 				layoutreader_action_get(layout, cur, &(action), &(argument));
-				while (list && strcmp(((struct layout_id *)list->data)->name, (char *)argument)) {
-					list=list->next;
-				}
-				if (list) trigger->object=((struct layout_id *)list->data)->object;
+				if (argument && g_hash_table_lookup_extended(layout->ids, argument, NULL, &object))
+					trigger->object=object;
 				else flo_error(_("Id %s was not found in layout file"), argument);
 			}
 		}
@@ -469,6 +495,27 @@ void layoutreader_sound_free(struct layout_sound *sound)
 	END_FUNC
 }
 
+/* return the validation document compiled from the relaxng file
+ * the compiled documents are kept until layoutreader_exit */
+static xmlRelaxNGPtr layoutreader_schema_get(char *relaxng)
+{
+	START_FUNC
+	xmlRelaxNGParserCtxtPtr rngctx;
+	xmlRelaxNGPtr rng;
+	if (!layoutreader_schemas)
+		layoutreader_schemas=g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)xmlRelaxNGFree);
+	if (!(rng=g_hash_table_lookup(layoutreader_schemas, relaxng))) {
+		rngctx=xmlRelaxNGNewParserCtxt(relaxng);
+		rng=xmlRelaxNGParse(rngctx);
+		xmlRelaxNGFreeParserCtxt(rngctx);
+		if (!rng) flo_fatal(_("Unable to parse the validation document %s"), relaxng);
+		g_hash_table_insert(layoutreader_schemas, g_strdup(relaxng), rng);
+	}
+	END_FUNC
+	return rng;
+}
+
 /* instanciates a new layout reader. Called in florence.c and style.c
  * can be called either for layout or style files
  * validates the xml layout against the relax-ng validation document
@@ -476,7 +523,6 @@ void layoutreader_sound_free(struct layout_sound *sound)
 struct layout *layoutreader_new(char *layoutname, char *defaultname, char *relaxng)
 {
 	START_FUNC
-	xmlRelaxNGParserCtxtPtr rngctx;
 	xmlRelaxNGPtr rng;
 	xmlRelaxNGValidCtxtPtr validrng;
         gchar *layoutfile=NULL;
@@ -486,8 +532,13 @@ struct layout *layoutreader_new(char *layoutname, char *defaultname, char *relax
 	int file_error=0;
 	struct layout *layout=g_malloc(sizeof(struct layout));
 	gboolean mustfree=FALSE;
+	GSList *files;
+	gchar *hash=NULL;
+	gboolean validate=TRUE;
+	gint64 start, parsed;
 
 	memset(layout, 0, sizeof(struct layout));
+	layout->ids=g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)xmlFree, NULL);
 	LIBXML_TEST_VERSION
 
 	layoutfile=layoutname;
@@ -521,26 +572,49 @@ struct layout *layoutreader_new(char *layoutname, char *defaultname, char *relax
 			flo_error(_("%s is a directory and no matching file has been found inside"),
 				layoutfile);
 			g_free(tmp);
+			g_hash_table_destroy(layout->ids);
 			g_free(layout);
+			END_FUNC
 			return NULL;
 		}
 		layoutfile=tmp; mustfree=TRUE;
 	}
-	layout->doc=xmlReadFile(layoutfile, NULL, XML_PARSE_NOENT|XML_PARSE_XINCLUDE);
-	if (!layout->doc) flo_fatal (_("Unable to open file %s."), layoutfile);
-	xmlXIncludeProcess(layout->doc);
-
-	rngctx=xmlRelaxNGNewParserCtxt(relaxng);
-	rng=xmlRelaxNGParse(rngctx);
-	validrng=xmlRelaxNGNewValidCtxt(rng);
-	if (0!=xmlRelaxNGValidateDoc(validrng, layout->doc))
-		flo_fatal(_("%s does not valdate against %s"), layoutfile, relaxng);
-	flo_debug(TRACE_DEBUG, _("Using file %s"), layoutfile);
-	if (mustfree) g_free(layoutfile);
+	/* the compiled cache skips the parsing, the inclusions and the validation */
+	if ((layout->doc=layoutcache_load(layoutfile, relaxng))) {
+		flo_debug(TRACE_DEBUG, _("Using file %s from the cache"), layoutfile);
+	} else {
+		start=g_get_monotonic_time();
+		layoutcache_record_start();
+		layout->doc=xmlReadFile(layoutfile, NULL, XML_PARSE_NOENT|XML_PARSE_XINCLUDE);
+		if (!layout->doc) flo_fatal (_("Unable to open file %s."), layoutfile);
+		xmlXIncludeProcess(layout->doc);
+		files=layoutcache_record_stop();
+		parsed=g_get_monotonic_time();
+
+		/* in 'unknown' mode, only the contents never validated before are validated */
+		if (!g_strcmp0(settings_peek_string(SETTINGS_VALIDATION), "unknown")) {
+			hash=layoutcache_content_hash(files, relaxng);
+			if (layoutcache_known(hash)) {
+				flo_debug(TRACE_DEBUG, _("%s is known to be valid"), layoutfile);
+				validate=FALSE;
+			}
+		}
+		if (validate) {
+			rng=layoutreader_schema_get(relaxng);
+			validrng=xmlRelaxNGNewValidCtxt(rng);
+			if (0!=xmlRelaxNGValidateDoc(validrng, layout->doc))
+				flo_fatal(_("%s does not valdate against %s"), layoutfile, relaxng);
+			xmlRelaxNGFreeValidCtxt(validrng);
+			if (hash) layoutcache_known_add(hash);
+		}
+		flo_debug(TRACE_DEBUG, _("Using file %s (parsed in %.1f ms, validated in %.1f ms)"), layoutfile,
+			(parsed-start)/1000., (g_get_monotonic_time()-parsed)/1000.);
+		g_free(hash);
 
-	xmlRelaxNGFreeValidCtxt(validrng);
-	xmlRelaxNGFree(rng);
-	xmlRelaxNGFreeParserCtxt(rngctx);
+		layoutcache_save(layout->doc, layoutfile, relaxng, files);
+		layoutcache_record_free(files);
+	}
+	if (mustfree) g_free(layoutfile);
 
 	if (!layout->doc || !layout->doc->children)
 		flo_error(_("File %s does not contain xml data"), layoutfile);
@@ -553,14 +627,18 @@ struct layout *layoutreader_new(char *layoutname, char *defaultname, char *relax
 void layoutreader_free(struct layout *layout)
 {
 	START_FUNC
-	GSList *list=layout->ids;
-	while (list) {
-		g_free(list->data);
-		list=list->next;
-	}
-	g_slist_free(layout->ids);
+	g_hash_table_destroy(layout->ids);
 	xmlFreeDoc(layout->doc);
 	g_free(layout);
 	END_FUNC
 }
 
+/* free the compiled validation documents */
+void layoutreader_exit(void)
+{
+	START_FUNC
+	if (layoutreader_schemas) g_hash_table_destroy(layoutreader_schemas);
+	layoutreader_schemas=NULL;
+	END_FUNC
+}
+
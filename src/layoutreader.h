@@ -26,18 +26,13 @@
 #include <libxml/tree.h>
 #include "config.h"
 
-/* Node id */
-struct layout_id {
-	void *object;
-	char *name;
-};
-
 /* The layout structure contains a pointer to the document
  * and a layout file cursor. */
 struct layout {
 	xmlDocPtr doc;
 	xmlNodePtr cur;
-	GSList *ids; /* list of node ids in document */
+	xmlNodePtr child; /* element opened by layoutreader_child_open */
+	GHashTable *ids; /* objects by node id */
 };
 
 /* This is used for placing extensions around the keyboard.
@@ -123,6 +118,8 @@ struct layout_sound {
 struct layout *layoutreader_new(char *layoutname, char *defaultname, char *relaxng);
 /* liberate memory for the reader */
 void layoutreader_free(struct layout *layout);
+/* free the validation documents compiled by layoutreader_new (to call at exit) */
+void layoutreader_exit(void);
 
 /* Get the 'informatons' element data (see florence.c) */
 struct layout_infos *layoutreader_infos_new(struct layout *layout);
@@ -168,6 +165,11 @@ void layoutreader_sound_free(struct layout_sound *sound);
 gboolean layoutreader_element_open(struct layout *layout, char *name);
 /* Close a layout element */
 void layoutreader_element_close(struct layout *layout);
+/* Open the element at the cursor whatever its name and return its name (NULL at the end of the level)
+ * this allows to read the children of an element in a single pass */
+const char *layoutreader_child_open(struct layout *layout);
+/* Close the element opened by layoutreader_child_open and move to the next one */
+void layoutreader_child_close(struct layout *layout);
 /* Reset layout cursor */
 void layoutreader_reset(struct layout *layout);
 
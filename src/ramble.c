@@ -140,7 +140,7 @@ void ramble_time_reset(struct ramble *ramble)
 gboolean ramble_add(struct ramble *ramble, GdkWindow *window, gint x, gint y, struct key *k)
 {
 	START_FUNC
-	gchar *val;
+	const gchar *val;
 	struct ramble_point *pt=g_malloc(sizeof(struct ramble_point));
 
 	/* Add the point to the path */
@@ -162,7 +162,7 @@ gboolean ramble_add(struct ramble *ramble, GdkWindow *window, gint x, gint y, st
 	if (!k) return FALSE;
 
 	/* Gesture detection */
-	val=settings_get_string(SETTINGS_RAMBLE_ALGO);
+	val=settings_peek_string(SETTINGS_RAMBLE_ALGO);
 	if (!strcmp("distance", val))
 		ramble_distance(ramble);
 	else if (!strcmp("time", val))
@@ -171,7 +171,6 @@ gboolean ramble_add(struct ramble *ramble, GdkWindow *window, gint x, gint y, st
 		flo_warn(_("Invalid ramble algorithm selected. Using default."));
 		ramble_distance(ramble);
 	}
-	if (val) g_free(val);
 
 	ramble->started=TRUE;
 	END_FUNC
@@ -0,0 +1,202 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#include "system.h"
+#include "trace.h"
+#include "scheduler.h"
+
+/* a scheduled callback */
+struct scheduler_task {
+	guint id; /* task identifier */
+	GSourceFunc func; /* callback: the task is cancelled when it returns FALSE */
+	gpointer data; /* data of the callback */
+	gint64 interval; /* period of a deadline, in microseconds */
+	gint64 due; /* monotonic time a deadline is due */
+};
+
+/* find the task in the list */
+static GSList *scheduler_task_find(GSList *list, guint id)
+{
+	for (; list; list=list->next)
+		if (((struct scheduler_task *)list->data)->id==id) break;
+	return list;
+}
+
+/* compare the due time of deadlines */
+static gint scheduler_deadline_cmp(gconstpointer a, gconstpointer b)
+{
+	gint64 da=((struct scheduler_task *)a)->due;
+	gint64 db=((struct scheduler_task *)b)->due;
+	return da<db?-1:(da>db?1:0);
+}
+
+/* call the animations: called by the frame clock */
+static gboolean scheduler_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+	START_FUNC
+	struct scheduler *scheduler=(struct scheduler *)user_data;
+	struct scheduler_task *task;
+	GSList *ids=NULL, *list, *item;
+	/* the callbacks may add or remove tasks: iterate over the identifiers */
+	for (list=scheduler->animations; list; list=list->next)
+		ids=g_slist_prepend(ids, GUINT_TO_POINTER(((struct scheduler_task *)list->data)->id));
+	ids=g_slist_reverse(ids);
+	for (list=ids; list; list=list->next) {
+		if (!(item=scheduler_task_find(scheduler->animations, GPOINTER_TO_UINT(list->data)))) continue;
+		task=(struct scheduler_task *)item->data;
+		if (!task->func(task->data)) {
+			scheduler->animations=g_slist_remove(scheduler->animations, task);
+			g_free(task);
+		}
+	}
+	g_slist_free(ids);
+	if (!scheduler->animations) scheduler->tick_id=0;
+	END_FUNC
+	return scheduler->animations?G_SOURCE_CONTINUE:G_SOURCE_REMOVE;
+}
+
+static gboolean scheduler_timer(gpointer data);
+
+/* arm the timeout source for the earliest deadline */
+static void scheduler_arm(struct scheduler *scheduler)
+{
+	START_FUNC
+	gint64 delay;
+	if (scheduler->timer_id) g_source_remove(scheduler->timer_id);
+	scheduler->timer_id=0;
+	if (scheduler->deadlines) {
+		delay=((struct scheduler_task *)scheduler->deadlines->data)->due-g_get_monotonic_time();
+		/* round up: the source must not fire before the deadline */
+		scheduler->timer_id=g_timeout_add(delay>0?(guint)((delay+999)/1000):0,
+			scheduler_timer, scheduler);
+	}
+	END_FUNC
+}
+
+/* call the deadlines that are due */
+static gboolean scheduler_timer(gpointer data)
+{
+	START_FUNC
+	struct scheduler *scheduler=(struct scheduler *)data;
+	struct scheduler_task *task;
+	gint64 now=g_get_monotonic_time();
+	scheduler->timer_id=0;
+	while (scheduler->deadlines && ((struct scheduler_task *)scheduler->deadlines->data)->due<=now) {
+		task=(struct scheduler_task *)scheduler->deadlines->data;
+		scheduler->deadlines=g_slist_delete_link(scheduler->deadlines, scheduler->deadlines);
+		if (task->func(task->data)) {
+			task->due=now+task->interval;
+			scheduler->deadlines=g_slist_insert_sorted(scheduler->deadlines, task,
+				scheduler_deadline_cmp);
+		} else g_free(task);
+	}
+	scheduler_arm(scheduler);
+	END_FUNC
+	return FALSE;
+}
+
+/* allocate a new task */
+static struct scheduler_task *scheduler_task_new(struct scheduler *scheduler, GSourceFunc func, gpointer data)
+{
+	START_FUNC
+	struct scheduler_task *task=g_malloc(sizeof(struct scheduler_task));
+	if (!task) flo_fatal(_("Unable to allocate memory for scheduler task"));
+	memset(task, 0, sizeof(struct scheduler_task));
+	/* 0 is never a valid identifier */
+	if (!(++scheduler->last_id)) scheduler->last_id++;
+	task->id=scheduler->last_id;
+	task->func=func;
+	task->data=data;
+	END_FUNC
+	return task;
+}
+
+/* add a callback to call at each frame until it returns FALSE. Returns the task identifier. */
+guint scheduler_animation_add(struct scheduler *scheduler, GSourceFunc func, gpointer data)
+{
+	START_FUNC
+	struct scheduler_task *task=scheduler_task_new(scheduler, func, data);
+	scheduler->animations=g_slist_append(scheduler->animations, task);
+	if (!scheduler->tick_id)
+		scheduler->tick_id=gtk_widget_add_tick_callback(scheduler->widget, scheduler_tick, scheduler, NULL);
+	END_FUNC
+	return task->id;
+}
+
+/* add a callback to call in interval milliseconds.
+ * The callback is called again after the same interval as long as it returns TRUE.
+ * Returns the task identifier. */
+guint scheduler_deadline_add(struct scheduler *scheduler, guint interval, GSourceFunc func, gpointer data)
+{
+	START_FUNC
+	struct scheduler_task *task=scheduler_task_new(scheduler, func, data);
+	task->interval=(gint64)interval*1000;
+	task->due=g_get_monotonic_time()+task->interval;
+	scheduler->deadlines=g_slist_insert_sorted(scheduler->deadlines, task, scheduler_deadline_cmp);
+	/* only re-arm when the new deadline is the earliest */
+	if (scheduler->deadlines->data==task) scheduler_arm(scheduler);
+	END_FUNC
+	return task->id;
+}
+
+/* cancel a task */
+void scheduler_remove(struct scheduler *scheduler, guint id)
+{
+	START_FUNC
+	GSList *item;
+	gboolean earliest;
+	if ((item=scheduler_task_find(scheduler->animations, id))) {
+		/* the tick callback stops by itself at the next frame */
+		g_free(item->data);
+		scheduler->animations=g_slist_delete_link(scheduler->animations, item);
+	} else if ((item=scheduler_task_find(scheduler->deadlines, id))) {
+		earliest=(item==scheduler->deadlines);
+		g_free(item->data);
+		scheduler->deadlines=g_slist_delete_link(scheduler->deadlines, item);
+		if (earliest) scheduler_arm(scheduler);
+	}
+	END_FUNC
+}
+
+/* create a scheduler using the frame clock of the widget */
+struct scheduler *scheduler_new(GtkWidget *widget)
+{
+	START_FUNC
+	struct scheduler *scheduler=g_malloc(sizeof(struct scheduler));
+	if (!scheduler) flo_fatal(_("Unable to allocate memory for scheduler"));
+	memset(scheduler, 0, sizeof(struct scheduler));
+	scheduler->widget=widget;
+	END_FUNC
+	return scheduler;
+}
+
+/* liberate the scheduler and cancel all tasks */
+void scheduler_free(struct scheduler *scheduler)
+{
+	START_FUNC
+	if (scheduler->tick_id) gtk_widget_remove_tick_callback(scheduler->widget, scheduler->tick_id);
+	if (scheduler->timer_id) g_source_remove(scheduler->timer_id);
+	g_slist_free_full(scheduler->animations, g_free);
+	g_slist_free_full(scheduler->deadlines, g_free);
+	g_free(scheduler);
+	END_FUNC
+}
+
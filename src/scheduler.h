@@ -0,0 +1,55 @@
+/* 
+   Florence - Florence is a simple virtual keyboard for Gnome.
+
+   Copyright (C) 2012 François Agrech
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  
+
+*/
+
+#ifndef FLO_SCHEDULER
+#define FLO_SCHEDULER
+
+#include <gtk/gtk.h>
+
+/* The scheduler drives all the periodic work of florence:
+ * the animations are called at each frame of the frame clock of the widget,
+ * and the deadlines share a single timeout source armed for the earliest one.
+ * Nothing is scheduled when nothing is animating or waiting. */
+struct scheduler {
+	GtkWidget *widget; /* widget whose frame clock drives the animations */
+	GSList *animations; /* callbacks called at each frame (struct scheduler_task) */
+	guint tick_id; /* tick callback of the widget or 0 */
+	GSList *deadlines; /* callbacks sorted by due time (struct scheduler_task) */
+	guint timer_id; /* timeout source of the earliest deadline or 0 */
+	guint last_id; /* identifier of the last task added */
+};
+
+/* add a callback to call at each frame until it returns FALSE. Returns the task identifier. */
+guint scheduler_animation_add(struct scheduler *scheduler, GSourceFunc func, gpointer data);
+/* add a callback to call in interval milliseconds.
+ * The callback is called again after the same interval as long as it returns TRUE.
+ * Returns the task identifier. */
+guint scheduler_deadline_add(struct scheduler *scheduler, guint interval, GSourceFunc func, gpointer data);
+/* cancel a task */
+void scheduler_remove(struct scheduler *scheduler, guint id);
+
+/* create a scheduler using the frame clock of the widget */
+struct scheduler *scheduler_new(GtkWidget *widget);
+/* liberate the scheduler and cancel all tasks */
+void scheduler_free(struct scheduler *scheduler);
+
+#endif
+
@@ -22,6 +22,7 @@
 #include "system.h"
 #include "trace.h"
 #include "service.h"
+#include "status.h"
 
 /* Service interface */
 static const gchar service_introspection[]=
@@ -34,10 +35,234 @@ static const gchar service_introspection[]=
 	"    </method>"
 	"    <method name='hide'/>"
 	"    <method name='terminate'/>"
+	"    <method name='type_text'>"
+	"      <arg type='s' name='text' direction='in'/>"
+	"      <arg type='u' name='count' direction='out'/>"
+	"      <arg type='d' name='rate' direction='out'/>"
+	"    </method>"
+	"    <method name='send_keys'>"
+	"      <arg type='a(ub)' name='keys' direction='in'/>"
+	"      <arg type='u' name='count' direction='out'/>"
+	"      <arg type='d' name='rate' direction='out'/>"
+	"    </method>"
 	"    <signal name='terminate'/>"
 	"  </interface>"
 	"</node>";
 
+#ifdef ENABLE_XTST
+/* a batch of injected events waiting to be flushed */
+struct service_batch {
+	GDBusMethodInvocation *invocation; /* method call to reply to */
+	guint count; /* number of characters or key events of the batch */
+	gint64 start; /* monotonic time of the method call */
+};
+
+/* Called when the batch has been flushed: reply with the throughput */
+static void service_batch_done(gint64 flushed, gpointer user_data)
+{
+	START_FUNC
+	struct service_batch *batch=(struct service_batch *)user_data;
+	gdouble rate=0.0;
+	if (flushed>batch->start)
+		rate=(gdouble)batch->count*G_USEC_PER_SEC/(gdouble)(flushed-batch->start);
+	flo_debug(TRACE_DEBUG, _("%u keys injected in %" G_GINT64_FORMAT "us (%.1f/s)"),
+		batch->count, flushed-batch->start, rate);
+	g_dbus_method_invocation_return_value(batch->invocation,
+		g_variant_new("(ud)", batch->count, rate));
+	g_free(batch);
+	END_FUNC
+}
+
+/* maximum number of spare key codes bound at the same time.
+ * Binding them again holds the injection queue, including the keys of the keyboard,
+ * for SERVICE_MAPPING_DELAY every SERVICE_SPARE_CODES distinct missing characters of a text */
+#define SERVICE_SPARE_CODES 16
+/* time given to the clients to handle the key events before the spare key codes are bound again (ms) */
+#define SERVICE_MAPPING_DELAY 100
+
+/* append an event to the sequence */
+static void service_event_append(GArray *events, enum inject_type type, guint code, KeySym keysym)
+{
+	struct inject_event event;
+	event.type=type;
+	event.code=code;
+	event.keysym=keysym;
+	event.mods=0;
+	event.delay=0;
+	g_array_append_val(events, event);
+}
+
+/* append the delayed unbinding of a spare key code to the sequence */
+static void service_unmap_append(GArray *events, guint code, guint delay)
+{
+	struct inject_event event;
+	event.type=INJECT_MAP;
+	event.code=code;
+	event.keysym=NoSymbol;
+	event.mods=0;
+	event.delay=delay;
+	g_array_append_val(events, event);
+}
+
+/* append an event setting the locked modifiers of the mask to the sequence */
+static void service_mods_append(GArray *events, GdkModifierType mask, GdkModifierType mods)
+{
+	struct inject_event event;
+	event.type=INJECT_MODS;
+	event.code=mask;
+	event.keysym=NoSymbol;
+	event.mods=mods;
+	event.delay=0;
+	g_array_append_val(events, event);
+}
+
+/* append the events typing the text to the sequence. Returns the number of characters typed.
+ * Characters missing from the current group are bound to spare key codes: each character gets
+ * its own code, and the codes are only bound again or unbound after a delay, so that the clients
+ * handling the mapping changes late still see the right keysym. */
+static guint service_text_events(struct xkeyboard *xkeyboard, const gchar *text, GArray *events)
+{
+	START_FUNC
+	guint count=0, keyval, code, level3code, spare_num, used=0, bound_max=0, i;
+	guint spares[SERVICE_SPARE_CODES];
+	guint shift=xkeyboard_modifier_code_get(xkeyboard, GDK_SHIFT_MASK);
+	GdkModifierType level3=xkeyboard_level3_get(xkeyboard, &level3code);
+	GdkModifierType mod, locked, latched, clear;
+	GHashTable *bound=g_hash_table_new(g_direct_hash, g_direct_equal);
+	gunichar c;
+	gboolean found;
+
+	spare_num=xkeyboard_spare_codes_get(xkeyboard, spares, SERVICE_SPARE_CODES);
+	/* the locked and latched level modifiers (caps lock, latched shift) would change the keysyms */
+	xkeyboard_mods_get(xkeyboard, &locked, &latched);
+	clear=(locked|latched)&(GDK_SHIFT_MASK|GDK_LOCK_MASK|level3);
+	if (clear) service_mods_append(events, clear, 0);
+
+	for (; *text; text=g_utf8_next_char(text)) {
+		c=g_utf8_get_char(text);
+		if (c=='\n') keyval=GDK_KEY_Return;
+		else if (c=='\t') keyval=GDK_KEY_Tab;
+		else keyval=gdk_unicode_to_keyval(c);
+		found=xkeyboard_keyval_code_get(xkeyboard, keyval, level3, &code, &mod);
+		if (found && (((mod&GDK_SHIFT_MASK) && !shift) || ((mod&level3) && !level3code)))
+			found=FALSE;
+		if (found) {
+			if (mod&GDK_SHIFT_MASK) service_event_append(events, INJECT_PRESS, shift, NoSymbol);
+			if (mod&level3) service_event_append(events, INJECT_PRESS, level3code, NoSymbol);
+			service_event_append(events, INJECT_PRESS, code, NoSymbol);
+			service_event_append(events, INJECT_RELEASE, code, NoSymbol);
+			if (mod&level3) service_event_append(events, INJECT_RELEASE, level3code, NoSymbol);
+			if (mod&GDK_SHIFT_MASK) service_event_append(events, INJECT_RELEASE, shift, NoSymbol);
+		} else {
+			code=GPOINTER_TO_UINT(g_hash_table_lookup(bound, GUINT_TO_POINTER(keyval)));
+			if (!code) {
+				if (!spare_num) {
+					flo_warn(_("No spare key code to type the character U+%04X"), c);
+					continue;
+				}
+				if (used==spare_num) {
+					/* every spare key code is bound: let the clients catch up before binding them again */
+					service_event_append(events, INJECT_WAIT, SERVICE_MAPPING_DELAY, NoSymbol);
+					g_hash_table_remove_all(bound);
+					used=0;
+				}
+				code=spares[used++];
+				if (used>bound_max) bound_max=used;
+				g_hash_table_insert(bound, GUINT_TO_POINTER(keyval), GUINT_TO_POINTER(code));
+				service_event_append(events, INJECT_MAP, code, keyval);
+			}
+			service_event_append(events, INJECT_PRESS, code, NoSymbol);
+			service_event_append(events, INJECT_RELEASE, code, NoSymbol);
+		}
+		count++;
+	}
+
+	if (clear) service_mods_append(events, clear, locked&clear);
+	/* give the spare key codes back once the clients had time to handle the key events.
+	 * The next key events are not held by these delayed mappings */
+	for (i=0; i<bound_max; i++) service_unmap_append(events, spares[i], SERVICE_MAPPING_DELAY);
+	g_hash_table_destroy(bound);
+	END_FUNC
+	return count;
+}
+
+/* inject the events as one batch and reply when they are flushed */
+static void service_events_send(struct service *service, GDBusMethodInvocation *invocation,
+	GArray *events, guint count, gint64 start)
+{
+	START_FUNC
+	struct inject *inject=service->view->status->inject;
+	struct service_batch *batch;
+	if (!inject) {
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+			_("XTest key injection is not available"));
+	} else if (events->len==0) {
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(ud)", 0, 0.0));
+	} else {
+		/* the worker has its own connection: the focus and group changes must come first */
+		if (service->view->status->inject_sync) {
+			XSync((Display *)gdk_x11_get_default_xdisplay(), False);
+			service->view->status->inject_sync=FALSE;
+		}
+		batch=g_malloc(sizeof(struct service_batch));
+		batch->invocation=invocation;
+		batch->count=count;
+		batch->start=start;
+		if (!inject_sequence(inject, (struct inject_event *)events->data, events->len,
+			service_batch_done, batch)) {
+			g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+				_("The %s key injection backend can't type characters missing from the keyboard "
+				"layout or change the locked modifiers"), inject->backend->name);
+			g_free(batch);
+		}
+	}
+	END_FUNC
+}
+
+/* Called when the type_text method is called */
+static void service_type_text(struct service *service, GVariant *parameters,
+	GDBusMethodInvocation *invocation)
+{
+	START_FUNC
+	gint64 start=g_get_monotonic_time();
+	const gchar *text;
+	GArray *events;
+	guint count;
+	g_variant_get(parameters, "(&s)", &text);
+	events=g_array_new(FALSE, FALSE, sizeof(struct inject_event));
+	count=service_text_events(service->view->status->xkeyboard, text, events);
+	service_events_send(service, invocation, events, count, start);
+	g_array_free(events, TRUE);
+	END_FUNC
+}
+
+/* Called when the send_keys method is called */
+static void service_send_keys(struct service *service, GVariant *parameters,
+	GDBusMethodInvocation *invocation)
+{
+	START_FUNC
+	gint64 start=g_get_monotonic_time();
+	GVariantIter *iter;
+	guint code;
+	gboolean pressed, valid=TRUE;
+	int min, max;
+	GArray *events=g_array_new(FALSE, FALSE, sizeof(struct inject_event));
+	/* a key code out of the key map would raise an X error */
+	XDisplayKeycodes((Display *)gdk_x11_get_default_xdisplay(), &min, &max);
+	g_variant_get(parameters, "(a(ub))", &iter);
+	while (valid && g_variant_iter_next(iter, "(ub)", &code, &pressed)) {
+		if ((code<(guint)min) || (code>(guint)max)) valid=FALSE;
+		else service_event_append(events, pressed?INJECT_PRESS:INJECT_RELEASE, code, NoSymbol);
+	}
+	g_variant_iter_free(iter);
+	if (!valid) g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+		_("Invalid key code %u: the key codes range from %d to %d"), code, min, max);
+	else service_events_send(service, invocation, events, events->len, start);
+	g_array_free(events, TRUE);
+	END_FUNC
+}
+#endif
+
 /* Called when a dbus method is called */
 static void service_method_call (GDBusConnection *connection, const gchar *sender,
 	const gchar *object_path, const gchar *interface_name, const gchar *method_name,
@@ -46,6 +271,19 @@ static void service_method_call (GDBusConnection *connection, const gchar *sende
 	START_FUNC
 	guint x, y;
 	struct service *service=(struct service *)user_data;
+	/* the key injection methods reply when the events are flushed */
+	if ((g_strcmp0(method_name, "type_text")==0) || (g_strcmp0(method_name, "send_keys")==0)) {
+#ifdef ENABLE_XTST
+		if (g_strcmp0(method_name, "type_text")==0)
+			service_type_text(service, parameters, invocation);
+		else service_send_keys(service, parameters, invocation);
+#else
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+			_("Xtest extension not compiled in"));
+#endif
+		END_FUNC
+		return;
+	}
 	if (g_strcmp0(method_name, "show")==0) {
 #ifdef AT_SPI
 		view_show(service->view, NULL);
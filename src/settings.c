@@ -41,6 +41,18 @@ struct settings_registration {
 	struct settings_registration *next;
 };
 
+/* in memory copy of a setting value, kept until the setting changes */
+struct settings_snapshot {
+	gboolean valid;
+	union {
+		gboolean vbool;
+		gchar *vstring;
+		gdouble vdouble;
+		gint vinteger;
+	} value;
+	struct settings_color color; /* parsed value of colour settings */
+};
+
 /* general informations related to the settings */
 struct settings_info {
 	GSettings *settings[SETTINGS_NUM_CATS];
@@ -49,6 +61,8 @@ struct settings_info {
 	GKeyFile *config;
 	gchar *config_file;
 	GSList *registrations;
+	struct settings_snapshot snapshot[SETTINGS_NUM_ITEMS]; /* copy of the values read */
+	gulong snapshot_ids[SETTINGS_NUM_CATS]; /* snapshot invalidation handlers */
 };
 
 /* GSettings category names */
@@ -101,6 +115,10 @@ static const struct settings_param settings_defaults[] = {
 	{ SETTINGS_STYLE, "flo_sounds", "sounds", SETTINGS_BOOL, { .vbool = TRUE } },
 	{ SETTINGS_STYLE, "flo_system_font", "system-font", SETTINGS_BOOL, { .vbool = TRUE } },
 	{ SETTINGS_STYLE, "flo_font", "font", SETTINGS_STRING, { .vstring = "sans 10" } },
+	{ SETTINGS_STYLE, SETTINGS_NONE, "tint-shapes", SETTINGS_BOOL, { .vbool = TRUE } },
+	{ SETTINGS_STYLE, SETTINGS_NONE, "symbols-cache", SETTINGS_INTEGER, { .vinteger = 32 } },
+	{ SETTINGS_BEHAVIOUR, SETTINGS_NONE, "injection-backend", SETTINGS_STRING, { .vstring = "xtest" } },
+	{ SETTINGS_LAYOUT, SETTINGS_NONE, "validation", SETTINGS_STRING, { .vstring = "always" } },
 	{ SETTINGS_WINDOW, SETTINGS_NONE, "xpos", SETTINGS_INTEGER, { .vinteger = 0 } },
 	{ SETTINGS_WINDOW, SETTINGS_NONE, "ypos", SETTINGS_INTEGER, { .vinteger = 0 } },
 	{ 0, NULL } };
@@ -141,6 +159,49 @@ struct settings_registration *settings_registration_get(enum settings_item key)
 	return ret;
 }
 
+/* forget the copy of a setting value */
+void settings_snapshot_clear(enum settings_item item)
+{
+	START_FUNC
+	struct settings_snapshot *snapshot=&(settings_infos->snapshot[item]);
+	if (snapshot->valid && ((settings_defaults[item].type==SETTINGS_STRING) ||
+		(settings_defaults[item].type==SETTINGS_COLOR)))
+		g_free(snapshot->value.vstring);
+	memset(snapshot, 0, sizeof(struct settings_snapshot));
+	END_FUNC
+}
+
+/* Called by GSettings when a value of the category changes:
+ * the copy of the value is read again at the next access */
+void settings_snapshot_invalidate(GSettings *settings, gchar *key, gpointer user_data)
+{
+	START_FUNC
+	enum settings_cat cat=GPOINTER_TO_INT(user_data);
+	enum settings_item item;
+	for (item=0; item<SETTINGS_NUM_ITEMS; item++) {
+		if ((settings_defaults[item].cat==cat) && (!strcmp(key, settings_defaults[item].settings_name)))
+			settings_snapshot_clear(item);
+	}
+	END_FUNC
+}
+
+/* parse a colour string (#rrggbb or #rrggbbaa) */
+void settings_color_parse(const gchar *str, struct settings_color *color)
+{
+	START_FUNC
+	guint r, g, b, a=255;
+	if ((!str) || ((4!=sscanf(str, "#%02x%02x%02x%02x", &r, &g, &b, &a)) &&
+		(3!=sscanf(str, "#%02x%02x%02x", &r, &g, &b)))) {
+		flo_warn(_("can't parse color %s"), str);
+		r=g=b=0; a=255;
+	}
+	color->red=(gdouble)r/255.0;
+	color->green=(gdouble)g/255.0;
+	color->blue=(gdouble)b/255.0;
+	color->alpha=(gdouble)a/255.0;
+	END_FUNC
+}
+
 /* Create a new GSettings object */
 GSettings *settings_new_object(gchar *file, const gchar *cat)
 {
@@ -175,6 +236,10 @@ void settings_init(gboolean exit, gchar *conf)
 	settings_infos->gtk_exit=exit;
 	for (cat=0; cat<SETTINGS_NUM_CATS; cat++) {
 		settings_infos->settings[cat]=settings_new_object(conf, settings_cat_names[cat]);
+		/* connected first so that the copies are invalid when the change callbacks are called */
+		if (settings_infos->settings[cat])
+			settings_infos->snapshot_ids[cat]=g_signal_connect(G_OBJECT(settings_infos->settings[cat]),
+				"changed", G_CALLBACK(settings_snapshot_invalidate), GINT_TO_POINTER(cat));
 	}
 	END_FUNC
 }
@@ -187,10 +252,14 @@ void settings_exit(void)
 	gsize len;
 	gchar *data=NULL;
 	enum settings_cat cat;
+	enum settings_item item;
 	if (settings_infos) {
 		for (cat=0; cat<SETTINGS_NUM_CATS; cat++)
-			if (settings_infos->settings[cat])
+			if (settings_infos->settings[cat]) {
+				g_signal_handler_disconnect(settings_infos->settings[cat], settings_infos->snapshot_ids[cat]);
 				g_object_unref(G_OBJECT(settings_infos->settings[cat]));
+			}
+		for (item=0; item<SETTINGS_NUM_ITEMS; item++) settings_snapshot_clear(item);
 		if (settings_infos->config) {
 			data=g_key_file_to_data(settings_infos->config, &len, NULL);
 			if (data) {
@@ -353,20 +422,48 @@ GVariant *settings_value_get(enum settings_item item)
 	return ret;
 }
 
+/* get the copy of a setting value, read from gsettings if needed */
+struct settings_snapshot *settings_snapshot_get(enum settings_item item)
+{
+	START_FUNC
+	struct settings_snapshot *snapshot=&(settings_infos->snapshot[item]);
+	GVariant *val;
+	if (!snapshot->valid) {
+		val=settings_value_get(item);
+		switch (settings_defaults[item].type) {
+			case SETTINGS_BOOL:
+				snapshot->value.vbool=val?g_variant_get_boolean(val):
+					settings_defaults[item].default_value.vbool;
+				break;
+			case SETTINGS_COLOR:
+			case SETTINGS_STRING:
+				snapshot->value.vstring=g_strdup(val?g_variant_get_string(val, NULL):
+					settings_defaults[item].default_value.vstring);
+				if (settings_defaults[item].type==SETTINGS_COLOR)
+					settings_color_parse(snapshot->value.vstring, &(snapshot->color));
+				break;
+			case SETTINGS_DOUBLE:
+				snapshot->value.vdouble=val?g_variant_get_double(val):
+					settings_defaults[item].default_value.vdouble;
+				break;
+			case SETTINGS_INTEGER:
+				snapshot->value.vinteger=val?(gint)g_variant_get_int32(val):
+					settings_defaults[item].default_value.vinteger;
+				break;
+		}
+		if (val) g_variant_unref(val);
+		snapshot->valid=TRUE;
+	}
+	END_FUNC
+	return snapshot;
+}
+
 /* get an integer from gsettings */
 gint settings_get_int(enum settings_item item)
 {
 	START_FUNC
-	gint ret=0;
-	GVariant *val=settings_value_get(item);
-	if (!val) {
-		ret=settings_defaults[item].default_value.vinteger;
-	} else {
-		ret=(gint)g_variant_get_int32(val);
-		g_variant_unref(val);
-	}
 	END_FUNC
-	return ret;
+	return settings_snapshot_get(item)->value.vinteger;
 }
 
 /* set a gsettings integer */
@@ -398,16 +495,8 @@ void settings_set_int(enum settings_item item, gint value)
 gdouble settings_get_double(enum settings_item item)
 {
 	START_FUNC
-	gdouble ret=0.0;
-	GVariant *val=settings_value_get(item);
-	if (!val) {
-		ret=settings_defaults[item].default_value.vdouble;
-	} else {
-		ret=g_variant_get_double(val);
-		g_variant_unref(val);
-	}
 	END_FUNC
-	return ret;
+	return settings_snapshot_get(item)->value.vdouble;
 }
 
 /* set a gsettings double */
@@ -439,16 +528,24 @@ void settings_set_double(enum settings_item item, double value, gboolean b)
 gchar *settings_get_string(enum settings_item item)
 {
 	START_FUNC
-	gchar *ret=NULL;
-	GVariant *val=settings_value_get(item);
-	if (!val) {
-		ret=g_strdup(settings_defaults[item].default_value.vstring);
-	} else {
-		ret=g_strdup(g_variant_get_string(val, NULL));
-		g_variant_unref(val);
-	}
 	END_FUNC
-	return ret;
+	return g_strdup(settings_snapshot_get(item)->value.vstring);
+}
+
+/* get a string from gsettings without copy */
+const gchar *settings_peek_string(enum settings_item item)
+{
+	START_FUNC
+	END_FUNC
+	return settings_snapshot_get(item)->value.vstring;
+}
+
+/* get a colour from gsettings */
+const struct settings_color *settings_get_color(enum settings_item item)
+{
+	START_FUNC
+	END_FUNC
+	return &(settings_snapshot_get(item)->color);
 }
 
 /* set a gsettings string */
@@ -467,16 +564,8 @@ void settings_set_string(enum settings_item item, const gchar *value)
 gboolean settings_get_bool(enum settings_item item)
 {
 	START_FUNC
-	gboolean ret=FALSE;
-	GVariant *val=settings_value_get(item);
-	if (!val) {
-		ret=settings_defaults[item].default_value.vbool;
-	} else {
-		ret=g_variant_get_boolean(val);
-		g_variant_unref(val);
-	}
 	END_FUNC
-	return ret;
+	return settings_snapshot_get(item)->value.vbool;
 }
 
 /* set a gsettings boolean */
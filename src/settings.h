@@ -76,6 +76,10 @@ enum settings_item {
 	SETTINGS_SOUNDS,
 	SETTINGS_SYSTEM_FONT,
 	SETTINGS_FONT,
+	SETTINGS_TINT_SHAPES,
+	SETTINGS_SYMBOLS_CACHE,
+	SETTINGS_INJECTION_BACKEND,
+	SETTINGS_VALIDATION,
 	SETTINGS_XPOS,
 	SETTINGS_YPOS,
 	SETTINGS_NUM_ITEMS
@@ -104,6 +108,14 @@ struct settings_param {
 	} default_value;
 };
 
+/* A colour setting parsed to rgba components between 0 and 1 */
+struct settings_color {
+	gdouble red;
+	gdouble green;
+	gdouble blue;
+	gdouble alpha;
+};
+
 /* Initialize the settings module */
 void settings_init(gboolean exit, gchar *conf);
 /* Liberate memory used by the settings module */
@@ -139,6 +151,10 @@ gint settings_get_int(enum settings_item item);
 void settings_set_int(enum settings_item item, gint value);
 /* get a GSettings string */
 gchar *settings_get_string(enum settings_item item);
+/* get a GSettings string without copy (valid until the setting changes) */
+const gchar *settings_peek_string(enum settings_item item);
+/* get a GSettings colour (valid until the setting changes) */
+const struct settings_color *settings_get_color(enum settings_item item);
 /* set a GSettings string */
 void settings_set_string(enum settings_item item, const gchar *value);
 /* get a GSettings boolean */
@@ -24,37 +24,64 @@
 #include "settings.h"
 #include <X11/Xproto.h>
 
-/* check for record events every 1/10th of a second */
-#define STATUS_EVENTCHECK_INTERVAL 100
-/* animate keyboard every 1/50th of a second */
-#define STATUS_ANIMATION_INTERVAL 20
 /* show visual effect for touched keys for 200ms */
 #define STATUS_TOUCH_TIMEOUT 200
 
-/* handle X11 errors */
-int status_error_handler(Display *my_dpy, XErrorEvent *event)
+/* track the focus changes of the focus window */
+GdkFilterReturn status_focus_filter(GdkXEvent *xevent, GdkEvent *event, gpointer data)
 {
 	START_FUNC
-	flo_warn(_("Unable to focus window."));
+	XEvent *ev=(XEvent *)xevent;
+	struct status_focus *focus=(struct status_focus *)data;
+	if (((ev->type==FocusOut) || (ev->type==FocusIn)) && (ev->xfocus.window==focus->w) &&
+		(ev->xfocus.detail!=NotifyInferior) && (ev->xfocus.detail!=NotifyPointer)) {
+		focus->lost=(ev->type==FocusOut);
+		flo_debug(TRACE_DEBUG, _("focus window %s the focus"), focus->lost?"lost":"got");
+	}
 	END_FUNC
-	return 0;
+	return GDK_FILTER_CONTINUE;
 }
 
-/* switch focus to focus window */
+/* start tracking the focus changes of the focus window */
+void status_focus_track(struct status_focus *focus)
+{
+	START_FUNC
+	/* the window may be gone: errors are reported asynchronously and ignored */
+	gdk_error_trap_push();
+	XSelectInput(gdk_x11_get_default_xdisplay(), focus->w, FocusChangeMask);
+	gdk_error_trap_pop_ignored();
+	/* focus the window on the first key event */
+	focus->lost=TRUE;
+	gdk_window_add_filter(NULL, status_focus_filter, focus);
+	END_FUNC
+}
+
+/* switch focus to focus window, only when it lost the focus.
+ * No round trip is made: the window is marked as focussed by the FocusIn event only,
+ * so a failed request is sent again on the next event */
 void status_focus_window(struct status *status)
 {
 	START_FUNC
-	int (*old_handler)(Display *, XErrorEvent *);
-	if (status->w_focus) {
-		old_handler=XSetErrorHandler(status_error_handler);
+	if (status->w_focus && status->w_focus->lost) {
+		gdk_error_trap_push();
 		XSetInputFocus(gdk_x11_get_default_xdisplay(), status->w_focus->w,
 				status->w_focus->revert_to, CurrentTime);
-		XSync(gdk_x11_get_default_xdisplay(), FALSE);
-		XSetErrorHandler(old_handler);
+		gdk_error_trap_pop_ignored();
+		status_inject_order(status);
 	}
 	END_FUNC
 }
 
+/* the requests just sent on the gdk display must be handled before the next injected key */
+void status_inject_order(struct status *status)
+{
+	START_FUNC
+#ifdef ENABLE_XTST
+	if (status->inject) status->inject_sync=TRUE;
+#endif
+	END_FUNC
+}
+
 /* update the global modifier mask */
 void status_globalmod_set(struct status *status, GdkModifierType mod)
 {
@@ -84,14 +111,19 @@ void status_record_event (XPointer priv, XRecordInterceptData *hook)
 	END_FUNC
 }
 
-/* Process record events (every 1/10th of a second) */
-gboolean status_record_process (gpointer data)
+/* Process record events when the record connection has data to read */
+gboolean status_record_process (GIOChannel *source, GIOCondition condition, gpointer data)
 {
 	START_FUNC
 	struct status *status=(struct status *)data;
-	XRecordProcessReplies(status->data_disp);
+	gboolean ret=TRUE;
+	if (condition&(G_IO_HUP|G_IO_ERR)) {
+		flo_warn(_("Record connection closed: keyboard synchronization is disabled."));
+		status->record_id=0;
+		ret=FALSE;
+	} else XRecordProcessReplies(status->data_disp);
 	END_FUNC
-	return TRUE;
+	return ret;
 }
 
 /* Record keyboard events */
@@ -102,6 +134,7 @@ gpointer status_record_start (gpointer data)
 	int major, minor;
 	XRecordRange *range;
 	XRecordClientSpec client;
+	GIOChannel *channel;
 	Display *ctrl_disp=(Display *)gdk_x11_get_default_xdisplay();
 
 	status->data_disp=XOpenDisplay(NULL);
@@ -117,6 +150,14 @@ gpointer status_record_start (gpointer data)
 			if (!XRecordEnableContextAsync(status->data_disp, status->RecordContext, status_record_event,
 				(XPointer)status))
 				flo_error(_("Unable to record events"));
+			else {
+				/* the record events are processed as soon as they arrive */
+				XFlush(status->data_disp);
+				channel=g_io_channel_unix_new(ConnectionNumber(status->data_disp));
+				status->record_id=g_io_add_watch(channel, G_IO_IN|G_IO_HUP|G_IO_ERR,
+					status_record_process, (gpointer)status);
+				g_io_channel_unref(channel);
+			}
 		} else flo_warn(_("Unable to create xrecord context"));
 		XFree(range);
 	}
@@ -130,6 +171,8 @@ gpointer status_record_start (gpointer data)
 void status_record_stop (struct status *status)
 {
 	START_FUNC
+	if (status->record_id) g_source_remove(status->record_id);
+	status->record_id=0;
 	if (status->RecordContext) {
 		XRecordDisableContext(status->data_disp, status->RecordContext);
 		XRecordFreeContext(status->data_disp, status->RecordContext);
@@ -265,9 +308,6 @@ void status_press (struct status *status, struct key *key)
 	if (((struct key_mod *)(key->mods->data))->type==KEY_ACTION)
 #endif
 	fsm_process(status, key, FSM_PRESSED);
-#ifdef ENABLE_XRECORD
-	status_record_process(status);
-#endif
 	END_FUNC
 }
 
@@ -284,12 +324,10 @@ void status_release (struct status *status, struct key *key)
 	if (status_im_get(status)==STATUS_IM_TOUCH && (!key_get_modifier(key))) {
 		key_state_set(key, KEY_PRESSED);
 		view_update(status->view, key, FALSE);
-		if (status->touch_id) g_source_remove(status->touch_id);
-		status->touch_id=g_timeout_add(STATUS_TOUCH_TIMEOUT, status_touch_timer, status);
+		if (status->touch_id) scheduler_remove(status->view->scheduler, status->touch_id);
+		status->touch_id=scheduler_deadline_add(status->view->scheduler,
+			STATUS_TOUCH_TIMEOUT, status_touch_timer, status);
 	}
-#ifdef ENABLE_XRECORD
-	status_record_process(status);
-#endif
 	END_FUNC
 }
 
@@ -407,6 +445,7 @@ void status_unlatch_all (struct status *status, struct key *key)
 		latched->state=KEY_RELEASED;
 		status->latched_keys=g_list_delete_link(status->latched_keys,
 			g_list_first(status->latched_keys));
+		status_globalmod_calc(status);
 		if (status->view) view_update(status->view, latched, TRUE);
 	}
 	status_globalmod_calc(status);
@@ -453,7 +492,8 @@ void status_timer_start(struct status *status, GSourceFunc update, gpointer data
 	if (status->timer) g_timer_start(status->timer);
 	else {
 		status->timer=g_timer_new();
-		g_timeout_add(STATUS_ANIMATION_INTERVAL, update, data);
+		/* the timer is drawn at each frame */
+		if (status->view) scheduler_animation_add(status->view->scheduler, update, data);
 	}
 	END_FUNC
 }
@@ -577,6 +617,20 @@ void status_input_method(GSettings *settings, gchar *key, gpointer user_data)
 	END_FUNC
 }
 
+#ifdef ENABLE_XTST
+/* called when the key injection backend is changed: restart the injection worker */
+void status_inject_backend(GSettings *settings, gchar *key, gpointer user_data)
+{
+	START_FUNC
+	struct status *status=(struct status *)user_data;
+	gchar *backend=settings_get_string(SETTINGS_INJECTION_BACKEND);
+	if (status->inject) inject_free(status->inject);
+	status->inject=inject_new(backend);
+	if (backend) g_free(backend);
+	END_FUNC
+}
+#endif
+
 /* get selected input method */
 enum status_input_method status_im_get(struct status *status)
 {
@@ -585,21 +639,53 @@ enum status_input_method status_im_get(struct status *status)
 	return status->input_method;
 }
 
+#ifdef ENABLE_AT_SPI2
+/* called when the at-spi registry failed to send a key event: send it with Xtest */
+static void status_spi_fallback(guint code, gboolean pressed, gpointer user_data)
+{
+	START_FUNC
+	struct status *status=(struct status *)user_data;
+#ifdef ENABLE_XTST
+	if (status->spi) {
+		flo_warn(_("ATSPI doesn't work. Using Xtst instead."));
+		status->spi=FALSE;
+	}
+	if (status->inject) inject_key(status->inject, code, pressed);
+	else XTestFakeKeyEvent((Display *)gdk_x11_get_default_xdisplay(), code, pressed, 0);
+#else
+	flo_warn(_("ATSPI doesn't work."));
+#endif
+	END_FUNC
+}
+#endif
+
 /* allocate memory for status */
 struct status *status_new(const gchar *focus_back)
 {
 	START_FUNC
 	gchar *im;
+#ifdef ENABLE_XTST
+	gchar *backend;
+#endif
 	struct status *status=g_malloc(sizeof(struct status));
 	if (!status) flo_fatal(_("Unable to allocate memory for status"));
 	memset(status, 0, sizeof(struct status));
 #ifdef ENABLE_XRECORD
 	status_record_start(status);
-	g_timeout_add(STATUS_EVENTCHECK_INTERVAL, status_record_process, (gpointer)status);
 #endif
 	status->spi=TRUE;
+#ifdef ENABLE_XTST
+	backend=settings_get_string(SETTINGS_INJECTION_BACKEND);
+	status->inject=inject_new(backend);
+	if (backend) g_free(backend);
+	settings_changecb_register(SETTINGS_INJECTION_BACKEND, status_inject_backend, status);
+#endif
+#ifdef ENABLE_AT_SPI2
+	status->a11y=a11y_new(status_spi_fallback, status);
+#endif
 	if (focus_back) {
 		status->w_focus=status_find_window(focus_back);
+		status_focus_track(status->w_focus);
 	}
 	im=settings_get_string(SETTINGS_INPUT_METHOD);
 	status_im_set(status, im);
@@ -615,12 +701,21 @@ void status_free(struct status *status)
 	START_FUNC
 #ifdef ENABLE_XRECORD
 	status_record_stop(status);
+#endif
+#ifdef ENABLE_AT_SPI2
+	if (status->a11y) a11y_free(status->a11y);
+#endif
+#ifdef ENABLE_XTST
+	if (status->inject) inject_free(status->inject);
 #endif
 	if (status->xkeyboard) xkeyboard_free(status->xkeyboard);
 	if (status->timer) g_timer_destroy(status->timer);
 	if (status->latched_keys) g_list_free(status->latched_keys);
 	if (status->locked_keys) g_list_free(status->locked_keys);
-	if (status->w_focus) g_free(status->w_focus);
+	if (status->w_focus) {
+		gdk_window_remove_filter(NULL, status_focus_filter, status->w_focus);
+		g_free(status->w_focus);
+	}
 	if (status) g_free(status);
 	END_FUNC
 }
@@ -27,12 +27,16 @@
 #include <X11/extensions/XTest.h>
 #include <X11/extensions/record.h>
 #include <gdk/gdkx.h>
+#include "inject.h"
 #endif
 #include <gtk/gtk.h>
 #include "key.h"
 #include "view.h"
 #include "xkeyboard.h"
 #include "fsm.h"
+#ifdef ENABLE_AT_SPI2
+#include "a11y.h"
+#endif
 
 /* input methods. */
 enum status_input_method {
@@ -63,6 +67,7 @@ void status_error (struct status *, struct key *);
 struct status_focus {
 	Window w; /* window that has the focus */
 	int revert_to; /* focus state of the focussed window */
+	gboolean lost; /* TRUE when the window lost the focus and must be focussed again */
 };
 
 /* This represents the status of florence */
@@ -77,11 +82,19 @@ struct status {
 	GdkModifierType globalmod; /* global modifier mask */
 	struct view *view; /* view to update on status change */
 	gboolean spi; /* tell if spi events are enabled */
+#ifdef ENABLE_AT_SPI2
+	struct a11y *a11y; /* asynchronous at-spi events or NULL to use the synchronous calls */
+#endif
 	gboolean moving; /* true when moving key is pressed */
 	struct status_focus *w_focus; /* window that has the focus, or NULL */
+#ifdef ENABLE_XTST
+	struct inject *inject; /* xtest injection queue or NULL to send events synchronously */
+	gboolean inject_sync; /* TRUE when requests on the gdk display must be handled before the next injected key */
+#endif
 #ifdef ENABLE_XRECORD
 	XRecordContext RecordContext; /* Context to record keyboard events */
 	Display *data_disp; /* Data display to record events */
+	guint record_id; /* watch of the data display connection */
 	struct key *keys[256]; /* keys by keycode. used to look up for key. */
 #endif
 	struct xkeyboard *xkeyboard; /* data from xkb */
@@ -95,6 +108,9 @@ void status_keys_add(struct status *status, GSList *keys);
 
 /* switch focus to focus window */
 void status_focus_window(struct status *status);
+/* the requests just sent on the gdk display (focus, group) must be handled by the server
+ * before the next key injected by the worker, which uses its own connection */
+void status_inject_order(struct status *status);
 /* update the focus key */
 void status_focus_set(struct status *status, struct key *focus);
 /* return the focus key */
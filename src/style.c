@@ -20,6 +20,7 @@
 */
 
 #include <stdio.h>
+#include <math.h>
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <librsvg/rsvg.h>
@@ -27,7 +28,7 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xmlsave.h>
-#include <gst/gst.h>
+#include "audio.h"
 #include "system.h"
 #include "trace.h"
 #include "key.h"
@@ -38,6 +39,24 @@
 /* Constants */
 static gchar *style_css_file_source=DATADIR "/florence.css";
 
+/* key of the shape atlas: colour class and size in pixels */
+#define STYLE_ATLAS_KEY(c, w, h) GUINT_TO_POINTER((((guint)(c))<<28)|(((w)&0x3FFF)<<14)|((h)&0x3FFF))
+
+/* 1 bit hit mask of a shape at a size in pixels */
+struct style_mask {
+	guint w, h; /* size of the mask */
+	guint *rows; /* offset of the bits of each row */
+	guchar *bits; /* one bit per pixel, identical consecutive rows are stored once */
+};
+
+/* colour independent layers of a shape rasterized at a size in pixels.
+ * The shape is tinted by masking the colours with the fill and outline layers. */
+struct style_layers {
+	cairo_surface_t *fill; /* alpha of the key colour */
+	cairo_surface_t *outline; /* alpha of the outline colour */
+	cairo_surface_t *overlay; /* colour independent part of the shape */
+};
+
 /* a symbol is drawn over the shape to identify the effect of key.
  * the symbol is either text (label) or svg. Either one is NULL */
 struct symbol {
@@ -46,8 +65,21 @@ struct symbol {
 		enum key_action_type type;
 	} id;
 	gchar *label;
-	RsvgHandle *svg;
+	RsvgHandle *svg; /* created on first draw (see style_symbol_svg_get) */
 	gchar *source;
+	guint position; /* rank of the symbol in the style: the first matching symbol is used */
+};
+
+/* settings of the style colours */
+static const enum settings_item style_color_items[STYLE_NUM_COLOURS]={
+	SETTINGS_KEY,
+	SETTINGS_OUTLINE,
+	SETTINGS_ACTIVATED,
+	SETTINGS_LATCHED,
+	SETTINGS_LABEL,
+	SETTINGS_LABEL_OUTLINE,
+	SETTINGS_MOUSEOVER,
+	SETTINGS_RAMBLE
 };
 
 /* color functions */
@@ -80,70 +112,63 @@ gchar *style_get_color(enum style_colours c)
 void style_cairo_set_color(cairo_t *cairoctx, enum style_colours c)
 {
 	START_FUNC
-	guint r, g, b, a;
-	gchar *color=style_get_color(c);
-	if (4==sscanf(color, "#%02x%02x%02x%02x", &r, &g, &b, &a)) {
-		cairo_set_source_rgba(cairoctx, (gdouble)r/255.0, (gdouble)g/255.0, (gdouble)b/255.0, (gdouble)a/255.0);
-	} else if (3!=sscanf(color, "#%02x%02x%02x", &r, &g, &b)) {
-		flo_warn(_("can't parse color %s"), color);
+	const struct settings_color *color;
+	if (c<STYLE_NUM_COLOURS) {
+		color=settings_get_color(style_color_items[c]);
+		cairo_set_source_rgba(cairoctx, color->red, color->green, color->blue, color->alpha);
+	} else {
+		flo_error(_("Unknown style color: %d"), c);
 		cairo_set_source_rgb(cairoctx, 0.0, 0.0, 0.0);
-	} else cairo_set_source_rgb(cairoctx, (gdouble)r/255.0, (gdouble)g/255.0, (gdouble)b/255.0);
-	if (color) g_free(color);
+	}
 	END_FUNC
 }
 
-/* insert css into an svg string */
-gchar *style_svg_css_insert(gchar *svg, enum style_colours c)
+/* replace every occurence of the placeholder in the css with value */
+gchar *style_css_replace(gchar *css, const gchar *placeholder, const gchar *value)
+{
+	START_FUNC
+	gchar **parts=g_strsplit(css, placeholder, -1);
+	gchar *ret=g_strjoinv(value, parts);
+	g_strfreev(parts);
+	g_free(css);
+	END_FUNC
+	return ret;
+}
+
+/* insert css into an svg string with the given colours */
+gchar *style_svg_css_colors_insert(gchar *svg, const gchar *shape, const gchar *border,
+	const gchar *sym, const gchar *sym_outline)
 {
 	START_FUNC
+	static gchar *css_source=NULL;
+	GError *error=NULL;
 	xmlSaveCtxtPtr save;
-	xmlBufferPtr buffer=xmlBufferCreate();
-	xmlDocPtr doc=xmlParseDoc((xmlChar *)svg);
-	xmlNodePtr root=xmlDocGetRootElement(doc);
-	FILE *in=fopen(style_css_file_source, "r");
-	xmlNodePtr style=xmlNewNode(NULL, (xmlChar *)"style");
-	gchar *line=g_malloc(1024*sizeof(gchar));
-	gchar *ret=NULL;
-	gchar *cur, *cur2, *color;
+	xmlBufferPtr buffer;
+	xmlDocPtr doc;
+	xmlNodePtr root, style;
+	gchar *css, *ret=NULL;
 
-	xmlNewProp(style, (xmlChar *)"type", (xmlChar *)"text/css");
-	if (!line) flo_warn(_("Unable to allocate memory for css read buffer"));
-	if (line && in) while ((line=fgets(line, 1024, in))) {
-		cur=cur2=line;
-		while ((*(cur++)!='\0') && (cur-line<1023)) {
-			if (!strncmp(cur, "@SHAPE_COLOR@", 13)) {
-				color=style_get_color(c);
-				memcpy((void *)cur, (void *)color, 7);
-				if (color) g_free(color);
-				cur+=7; cur2+=13;
-			} else if (!strncmp(cur, "@BORDER_COLOR@", 14)) {
-				color=style_get_color(STYLE_OUTLINE_COLOR);
-				memcpy((void *)cur, (void *)color, 7);
-				if (color) g_free(color);
-				cur+=7; cur2+=14;
-			} else if (!strncmp(cur, "@SYM_COLOR@", 11)) {
-				color=style_get_color(STYLE_TEXT_COLOR);
-				memcpy((void *)cur, (void *)color, 7);
-				if (color) g_free(color);
-				cur+=7; cur2+=11;
-			} else if (!strncmp(cur, "@SYM_OUTLINE_COLOR@", 19)) {
-				color=style_get_color(STYLE_TEXT_OUTLINE_COLOR);
-				memcpy((void *)cur, (void *)color, 7);
-				if (color) g_free(color);
-				cur+=7; cur2+=19;
-			}
-			*cur=*(++cur2);
-		}
-		*cur='\0';
-		xmlNodeAddContent(style, (xmlChar *)line);
+	/* the css file is read only once */
+	if (!css_source && !g_file_get_contents(style_css_file_source, &css_source, NULL, &error)) {
+		flo_warn(_("Unable to read css file %s: %s"), style_css_file_source, error->message);
+		g_error_free(error);
+		css_source=g_strdup("");
 	}
-	g_free(line);
-	fclose(in);
+	css=style_css_replace(g_strdup(css_source), "@SHAPE_COLOR@", shape);
+	css=style_css_replace(css, "@BORDER_COLOR@", border);
+	css=style_css_replace(css, "@SYM_COLOR@", sym);
+	css=style_css_replace(css, "@SYM_OUTLINE_COLOR@", sym_outline);
 
+	doc=xmlParseDoc((xmlChar *)svg);
+	root=xmlDocGetRootElement(doc);
 	if (!root) flo_fatal(_("Can not parse style file."));
 	if (strcmp((char *)root->name, "svg"))
 		flo_error("element svg expected, but %s found instead", root->name);
+	style=xmlNewNode(NULL, (xmlChar *)"style");
+	xmlNewProp(style, (xmlChar *)"type", (xmlChar *)"text/css");
+	xmlNodeAddContent(style, (xmlChar *)css);
 	xmlAddPrevSibling(root->children, style);
+	buffer=xmlBufferCreate();
 	save=xmlSaveToBuffer(buffer, NULL, 0);
 	xmlSaveTree(save, root);
 	xmlSaveClose(save);
@@ -151,6 +176,27 @@ gchar *style_svg_css_insert(gchar *svg, enum style_colours c)
 
 	xmlFreeDoc(doc);
 	xmlBufferFree(buffer);
+	g_free(css);
+	END_FUNC
+	return ret;
+}
+
+/* insert css into an svg string */
+gchar *style_svg_css_insert(gchar *svg, enum style_colours c)
+{
+	START_FUNC
+	gchar *shape=style_get_color(c);
+	gchar *border=style_get_color(STYLE_OUTLINE_COLOR);
+	gchar *sym=style_get_color(STYLE_TEXT_COLOR);
+	gchar *sym_outline=style_get_color(STYLE_TEXT_OUTLINE_COLOR);
+	gchar *ret;
+	/* colours are inserted without the alpha channel */
+	if (strlen(shape)>7) shape[7]='\0';
+	if (strlen(border)>7) border[7]='\0';
+	if (strlen(sym)>7) sym[7]='\0';
+	if (strlen(sym_outline)>7) sym_outline[7]='\0';
+	ret=style_svg_css_colors_insert(svg, shape, border, sym, sym_outline);
+	g_free(shape); g_free(border); g_free(sym); g_free(sym_outline);
 	END_FUNC
 	return ret;
 }
@@ -199,52 +245,96 @@ void style_render_svg(cairo_t *cairoctx, RsvgHandle *handle, gdouble w, gdouble
 	END_FUNC
 }
 
+/* free up memory used by the symbol */
+void style_symbol_free(gpointer data, gpointer userdata)
+{
+	START_FUNC
+	struct symbol *symbol=(struct symbol *)data;
+	if (symbol) {
+		if (symbol->id.name) g_regex_unref(symbol->id.name);
+		if (symbol->label) g_free(symbol->label);
+		if (symbol->svg) g_object_unref(G_OBJECT(symbol->svg));
+		if (symbol->source) g_free(symbol->source);
+		g_free(symbol);
+	}
+	END_FUNC
+}
+
+/* return TRUE if the symbol name is a plain keyval name rather than a regular expression */
+gboolean style_symbol_literal(const gchar *name)
+{
+	START_FUNC
+	const gchar *c;
+	for (c=name; *c && (g_ascii_isalnum(*c) || *c=='_'); c++);
+	END_FUNC
+	return *c=='\0';
+}
+
 /* create a new symbol */
 void style_symbol_new(struct style *style, char *name, char *svg, char *label, char *type)
 {
 	START_FUNC
-	GError *error=NULL;
 	gchar *regex=NULL;
-	gchar *source=NULL;
 	struct symbol *symbol=g_malloc(sizeof(struct symbol));
 	memset(symbol, 0, sizeof(struct symbol));
 	if ((!type) && name) {
-		regex=g_strdup_printf("^%s$", name);
-		symbol->id.name=g_regex_new(regex, G_REGEX_OPTIMIZE, G_REGEX_MATCH_ANCHORED, NULL);
-		g_free(regex);
+		symbol->position=style->symbol_count++;
+		/* plain names are looked up in a hash table, only the patterns are matched */
+		if (style_symbol_literal(name)) {
+			if (!g_hash_table_lookup(style->symbol_names, name))
+				g_hash_table_insert(style->symbol_names, g_strdup(name), symbol);
+		} else {
+			regex=g_strdup_printf("^%s$", name);
+			symbol->id.name=g_regex_new(regex, G_REGEX_OPTIMIZE, G_REGEX_MATCH_ANCHORED, NULL);
+			g_free(regex);
+			style->symbol_patterns=g_slist_prepend(style->symbol_patterns, (gpointer)symbol);
+		}
 	}
 	if (label) {
 		symbol->label=g_strdup(label);
 	} else if (svg) {
+		/* the svg handle is only created when the symbol is drawn */
 		symbol->source=g_strdup(svg);
-		source=style_svg_css_insert(svg, STYLE_KEY_COLOR);
-		symbol->svg=rsvg_handle_new_from_data((guint8 *)source, (gsize)strlen(source), &error);
-		if (source) g_free(source);
-		if (error) flo_fatal(_("Unable to parse svg from layout file: %s"), svg);
 	} else { flo_fatal(_("Bad symbol: should have either svg or label :%s"), name); }
 	if (type) {
 		symbol->id.type=key_action_type_get(type);
-		style->type_symbols=g_slist_append(style->type_symbols, (gpointer)symbol);
+		/* the first symbol of a type is used */
+		if (!style->type_symbols[symbol->id.type])
+			style->type_symbols[symbol->id.type]=symbol;
+		else {
+			symbol->id.name=NULL;
+			style_symbol_free((gpointer)symbol, NULL);
+		}
 	} else {
-		style->symbols=g_slist_append(style->symbols, (gpointer)symbol);
+		/* the list is reversed once the style is loaded */
+		style->symbols=g_slist_prepend(style->symbols, (gpointer)symbol);
 	}
 	flo_debug(TRACE_DEBUG, "[new symbol] name=%s label=%s", name, symbol->label);
 	END_FUNC
 }
 
-/* free up memory used by the symbol */
-void style_symbol_free(gpointer data, gpointer userdata)
+/* return the svg handle of the symbol, created on first use (NULL if the svg is invalid) */
+RsvgHandle *style_symbol_svg_get(struct style *style, struct symbol *symbol)
 {
 	START_FUNC
-	struct symbol *symbol=(struct symbol *)data;
-	if (symbol) {
-		if (symbol->id.name) g_regex_unref(symbol->id.name);
-		if (symbol->label) g_free(symbol->label);
-		if (symbol->svg) g_object_unref(G_OBJECT(symbol->svg));
-		if (symbol->source) g_free(symbol->source);
-		g_free(symbol);
+	GError *error=NULL;
+	gchar *source;
+	if (!symbol->svg && symbol->source) {
+		source=style_svg_css_insert(symbol->source, STYLE_KEY_COLOR);
+		symbol->svg=rsvg_handle_new_from_data((guint8 *)source, (gsize)strlen(source), &error);
+		if (error) {
+			flo_warn(_("Unable to parse svg from layout file: %s"), symbol->source);
+			g_error_free(error);
+			if (symbol->svg) g_object_unref(G_OBJECT(symbol->svg));
+			symbol->svg=NULL;
+			/* don't try again */
+			g_free(symbol->source);
+			symbol->source=NULL;
+		} else style->symbol_svgs++;
+		g_free(source);
 	}
 	END_FUNC
+	return symbol->svg;
 }
 
 /* return TRUE if the name matches the symbol regexp */
@@ -256,20 +346,16 @@ gboolean style_symbol_matches(struct symbol *symbol, gchar *name)
 	return g_regex_match(symbol->id.name, name, G_REGEX_MATCH_ANCHORED|G_REGEX_MATCH_NOTEMPTY, NULL);
 }
 
-/* Draws text with cairo */
-void style_draw_text(struct style *style, cairo_t *cairoctx, gchar *text, gdouble w, gdouble h)
+/* load the font face and size of the labels from the settings */
+void style_font_load(struct style *style)
 {
 	START_FUNC
-	cairo_font_extents_t fe;
-	cairo_text_extents_t te;
 	PangoFontDescription *fontdesc;
 	gchar *fontname;
 	const gchar *fontfamilly;
 	GtkSettings *settings=NULL;
 	cairo_font_slant_t slant;
-	gint size=0.0;
-
-	style_cairo_status_check(cairoctx);
+	gdouble size;
 
 	if (settings_get_bool(SETTINGS_SYSTEM_FONT)) {
 		settings=gtk_settings_get_default();
@@ -285,56 +371,128 @@ void style_draw_text(struct style *style, cairo_t *cairoctx, gchar *text, gdoubl
 		default: flo_warn(_("unknown slant for font %s: %d"), fontfamilly, pango_font_description_get_style(fontdesc));
 			slant=CAIRO_FONT_SLANT_NORMAL; break;
 	}
-
-	cairo_save(cairoctx);
-	style_cairo_set_color(cairoctx, STYLE_TEXT_OUTLINE_COLOR);
-	cairo_select_font_face(cairoctx, fontfamilly, slant, 
+	style->font_face=cairo_toy_font_face_create(fontfamilly?fontfamilly:"sans", slant,
 		pango_font_description_get_weight(fontdesc)<=500?CAIRO_FONT_WEIGHT_NORMAL:CAIRO_FONT_WEIGHT_BOLD);
 	size=pango_font_description_get_size(fontdesc);
 	if (pango_font_description_get_size_is_absolute(fontdesc)) {
 		size=pango_units_to_double(size);
 	}
-	cairo_set_font_size(cairoctx, (gdouble)(size)/12800.);
+	style->font_size=size/12800.;
+	pango_font_description_free(fontdesc);
+	END_FUNC
+}
+
+/* forget the font and the label outlines (to call when the font changes) */
+void style_font_flush(struct style *style)
+{
+	START_FUNC
+	if (style->font_face) cairo_font_face_destroy(style->font_face);
+	style->font_face=NULL;
+	g_hash_table_remove_all(style->labels);
+	END_FUNC
+}
+
+/* set the font size of the context so that the text fits in the box
+ * and move to the origin of the centered text */
+void style_text_fit(cairo_t *cairoctx, gchar *text, gdouble size, gdouble w, gdouble h)
+{
+	START_FUNC
+	cairo_font_extents_t fe;
+	cairo_text_extents_t te;
+	cairo_set_font_size(cairoctx, size);
 	cairo_text_extents(cairoctx, text, &te);
 	cairo_font_extents(cairoctx, &fe);
 	if (te.width > w) {
 		size=size*w/te.width;
-		cairo_set_font_size(cairoctx, (gdouble)(size)/12800.);
+		cairo_set_font_size(cairoctx, size);
 		cairo_text_extents(cairoctx, text, &te);
 		cairo_font_extents(cairoctx, &fe);
 	} 
 	if (fe.height > h) {
-		cairo_set_font_size(cairoctx, (gdouble)(size*h/fe.height)/12800.);
+		cairo_set_font_size(cairoctx, size*h/fe.height);
 		cairo_text_extents(cairoctx, text, &te);
 		cairo_font_extents(cairoctx, &fe);
 	}
 	cairo_move_to(cairoctx, (w-te.width)/2.-te.x_bearing, ((h+fe.height)/2.)-fe.descent);
+	END_FUNC
+}
+
+/* Draws text with cairo */
+void style_draw_text(struct style *style, cairo_t *cairoctx, gchar *text, gdouble w, gdouble h)
+{
+	START_FUNC
+	cairo_path_t *path;
+	gchar *id;
+
+	style_cairo_status_check(cairoctx);
+
+	/* the outline of the text is computed once for a box size */
+	id=g_strdup_printf("%g %g %s", w, h, text);
+	if (!(path=(cairo_path_t *)g_hash_table_lookup(style->labels, id))) {
+		if (!style->font_face) style_font_load(style);
+		cairo_save(cairoctx);
+		cairo_set_font_face(cairoctx, style->font_face);
+		style_text_fit(cairoctx, text, style->font_size, w, h);
+		cairo_new_path(cairoctx);
+		cairo_text_path(cairoctx, text);
+		path=cairo_copy_path(cairoctx);
+		cairo_new_path(cairoctx);
+		cairo_restore(cairoctx);
+		g_hash_table_insert(style->labels, id, path);
+	} else g_free(id);
+
+	cairo_save(cairoctx);
+	cairo_new_path(cairoctx);
+	cairo_append_path(cairoctx, path);
+	style_cairo_set_color(cairoctx, STYLE_TEXT_OUTLINE_COLOR);
 	cairo_set_line_width(cairoctx, 0.1);
-	cairo_text_path(cairoctx, text);
-	cairo_stroke(cairoctx);
+	cairo_stroke_preserve(cairoctx);
 	style_cairo_set_color(cairoctx, STYLE_TEXT_COLOR);
-	cairo_move_to(cairoctx, (w-te.width)/2.-te.x_bearing, ((h+fe.height)/2.)-fe.descent);
-	cairo_text_path(cairoctx, text);
 	cairo_fill(cairoctx);
 	cairo_restore(cairoctx);
+	END_FUNC
+}
 
-	pango_font_description_free(fontdesc);
+/* return the symbol matching the keyval name or NULL.
+ * The regular expressions are only matched the first time a keyval is looked up */
+struct symbol *style_symbol_get(struct style *style, guint keyval)
+{
+	START_FUNC
+	GSList *item;
+	gpointer symbol=NULL;
+	gchar *name;
+	guint position;
+	if (!g_hash_table_lookup_extended(style->symbol_index, GUINT_TO_POINTER(keyval), NULL, &symbol)) {
+		name=gdk_keyval_name(keyval);
+		symbol=name?g_hash_table_lookup(style->symbol_names, name):NULL;
+		/* a pattern defined before the plain name takes precedence */
+		position=symbol?((struct symbol *)symbol)->position:G_MAXUINT;
+		for (item=style->symbol_patterns;
+			item && ((struct symbol *)item->data)->position<position;
+			item=g_slist_next(item)) {
+			if (style_symbol_matches((struct symbol *)item->data, name)) {
+				symbol=item->data;
+				break;
+			}
+		}
+		/* misses are cached too */
+		g_hash_table_insert(style->symbol_index, GUINT_TO_POINTER(keyval), symbol);
+	}
 	END_FUNC
+	return (struct symbol *)symbol;
 }
 
 /* Draw the symbol represented by keyval */
 void style_symbol_draw(struct style *style, cairo_t *cairoctx, guint keyval, gdouble w, gdouble h)
 {
 	START_FUNC
-	GSList *item=style->symbols;
+	struct symbol *symbol=style_symbol_get(style, keyval);
+	RsvgHandle *svg;
 	gchar name[7];
 	guint keyval2=keyval;
 
-	while (item && !style_symbol_matches((struct symbol *)item->data, gdk_keyval_name(keyval))) {
-		item=g_slist_next(item);
-	}
 	/* No predifined symbol => get the label according to keyval */
-	if (!item) {
+	if (!symbol) {
 		/* find the string representation of keyval */
 		name[0]='\0';
 		if (gdk_keyval_name(keyval) && !strncmp(gdk_keyval_name(keyval), "dead_", 5)) {
@@ -345,11 +503,11 @@ void style_symbol_draw(struct style *style, cairo_t *cairoctx, guint keyval, gdo
 		/* if (!name[0] && gdk_keyval_name(keyval)) { strncpy(name, gdk_keyval_name(keyval), 3); name[3]='\0'; } */
 		if (*name) style_draw_text(style, cairoctx, name, w, h);
 	/* the symbol has a label ==> let's draw it */
-	} else if (((struct symbol *)item->data)->label) {
-		style_draw_text(style, cairoctx, ((struct symbol *)item->data)->label, w, h);
+	} else if (symbol->label) {
+		style_draw_text(style, cairoctx, symbol->label, w, h);
 	/* the symbol must have a svg => draw it */
-	} else {
-		style_render_svg(cairoctx, ((struct symbol *)item->data)->svg, w, h, TRUE, NULL);
+	} else if ((svg=style_symbol_svg_get(style, symbol))) {
+		style_render_svg(cairoctx, svg, w, h, TRUE, NULL);
 	}
 	END_FUNC
 }
@@ -358,15 +516,14 @@ void style_symbol_draw(struct style *style, cairo_t *cairoctx, guint keyval, gdo
 void style_symbol_type_draw(struct style *style, cairo_t *cairoctx, enum key_action_type type, gdouble w, gdouble h)
 {
 	START_FUNC
-	GSList *item=style->type_symbols;
-	while (item && (type!=((struct symbol *)item->data)->id.type)) {
-		item=g_slist_next(item);
-	}
-	if (item) {
-		if (((struct symbol *)item->data)->label) {
-			style_draw_text(style, cairoctx, ((struct symbol *)item->data)->label, w, h);
-		} else {
-			style_render_svg(cairoctx, ((struct symbol *)item->data)->svg, w, h, TRUE, NULL);
+	struct symbol *symbol=NULL;
+	RsvgHandle *svg;
+	if (type<KEY_ACTION_TYPE_NUM) symbol=style->type_symbols[type];
+	if (symbol) {
+		if (symbol->label) {
+			style_draw_text(style, cairoctx, symbol->label, w, h);
+		} else if ((svg=style_symbol_svg_get(style, symbol))) {
+			style_render_svg(cairoctx, svg, w, h, TRUE, NULL);
 		}
 	} else flo_error(_("No style symbol for action key %d"), type);
 	END_FUNC
@@ -377,26 +534,17 @@ void style_shape_new(struct style *style, char *name, char *svg)
 {
 	START_FUNC
 	struct shape *shape=g_malloc(sizeof(struct shape));
-	GError *error=NULL;
-	gchar *default_uri, *source;
 	memset(shape, 0, sizeof(struct shape));
+	shape->style=style;
 	if (name) shape->name=g_strdup(name);
-	if (svg) {
-		source=style_svg_css_insert(svg, STYLE_KEY_COLOR);
-		shape->source=(guchar *)g_strdup(svg);
-	}
-	shape->svg=rsvg_handle_new();
-	default_uri=settings_get_string(SETTINGS_STYLE_ITEM);
-	rsvg_handle_set_base_uri(shape->svg, style->base_uri?style->base_uri:default_uri);
-	if (default_uri) g_free(default_uri);
-	rsvg_handle_write(shape->svg, (guchar *)source, (gsize)strlen(source), &error);
-	rsvg_handle_close(shape->svg, &error);
-	if (error) flo_fatal(_("Unable to parse svg from layout file: svg=\"%s\" error=\"%s\""),
-		source, error->message);
-	style->shapes=g_slist_append(style->shapes, (gpointer)shape);
+	/* the svg handle is only created when the shape is used */
+	if (svg) shape->source=(guchar *)g_strdup(svg);
+	/* the list is reversed once the style is loaded */
+	style->shapes=g_slist_prepend(style->shapes, (gpointer)shape);
+	if (shape->name && !g_hash_table_lookup(style->shape_index, shape->name))
+		g_hash_table_insert(style->shape_index, shape->name, shape);
 	if (!strcmp(name, "default")) style->default_shape=shape;
-	flo_debug(TRACE_DEBUG, _("[new shape] name=%s svg=\"%s\""), shape->name, source);
-	if (source) g_free(source);
+	flo_debug(TRACE_DEBUG, _("[new shape] name=%s svg=\"%s\""), shape->name, svg);
 	END_FUNC
 }
 
@@ -409,7 +557,12 @@ void style_shape_free(gpointer data, gpointer userdata)
 		if (shape->name) g_free(shape->name);
 		if (shape->source) g_free(shape->source);
 		if (shape->svg) g_object_unref(G_OBJECT(shape->svg));
-		if (shape->mask) cairo_surface_destroy(shape->mask);
+		if (shape->masks) g_hash_table_destroy(shape->masks);
+		if (shape->atlas) g_hash_table_destroy(shape->atlas);
+		if (shape->layers) g_hash_table_destroy(shape->layers);
+		if (shape->fill) g_object_unref(G_OBJECT(shape->fill));
+		if (shape->outline) g_object_unref(G_OBJECT(shape->outline));
+		if (shape->overlay) g_object_unref(G_OBJECT(shape->overlay));
 		g_free(shape);
 	}
 	END_FUNC
@@ -419,12 +572,9 @@ void style_shape_free(gpointer data, gpointer userdata)
 struct shape *style_shape_get (struct style *style, gchar *name)
 {
 	START_FUNC
-	GSList *item=style->shapes;
 	struct shape *ret=NULL;
 	if (name) {
-		while (item && strcmp(((struct shape *)item->data)->name, name)) item=g_slist_next(item);
-		if (item) ret=(struct shape *)item->data;
-		else {
+		if (!(ret=g_hash_table_lookup(style->shape_index, name))) {
 			flo_warn(_("Shape %s doesn't exist for selected style."), name);
 			ret=style->default_shape;
 		}
@@ -433,78 +583,286 @@ struct shape *style_shape_get (struct style *style, gchar *name)
 	return ret;
 }
 
-/* draw the shape to the cairo context. */
-void style_shape_draw(struct style *style, struct shape *shape, cairo_t *cairoctx,
-	gdouble w, gdouble h, enum style_colours c)
+/* create a svg handle for a shape source with css inserted */
+RsvgHandle *style_shape_svg_new(struct style *style, gchar *source)
 {
 	START_FUNC
-	gchar *source, *default_uri;
-	RsvgHandle *svg;
+	gchar *default_uri;
 	GError *error=NULL;
-	if (c==STYLE_KEY_COLOR) {
-		style_render_svg(cairoctx, shape->svg, w, h, FALSE, NULL);
+	RsvgHandle *svg=rsvg_handle_new();
+	if (style->base_uri) rsvg_handle_set_base_uri(svg, style->base_uri);
+	else {
+		default_uri=settings_get_string(SETTINGS_STYLE_ITEM);
+		rsvg_handle_set_base_uri(svg, default_uri);
+		if (default_uri) g_free(default_uri);
+	}
+	rsvg_handle_write(svg, (guchar *)source, (gsize)strlen(source), &error);
+	rsvg_handle_close(svg, &error);
+	if (error) {
+		flo_warn(_("Unable to parse svg from layout file: svg=\"%s\" error=\"%s\""),
+			source, error->message);
+		g_error_free(error);
+	}
+	style->shape_svgs++;
+	END_FUNC
+	return svg;
+}
+
+/* return the svg handle of the shape in the key colour, created on first use */
+RsvgHandle *style_shape_svg_get(struct shape *shape)
+{
+	START_FUNC
+	gchar *source;
+	if (!shape->svg) {
+		source=style_svg_css_insert((gchar *)shape->source, STYLE_KEY_COLOR);
+		shape->svg=style_shape_svg_new(shape->style, source);
+		g_free(source);
+	}
+	END_FUNC
+	return shape->svg;
+}
+
+/* create a svg handle for a layer of the shape */
+RsvgHandle *style_shape_layer_new(struct style *style, struct shape *shape,
+	const gchar *fill, const gchar *outline)
+{
+	START_FUNC
+	gchar *source=style_svg_css_colors_insert((gchar *)shape->source, fill, outline, "none", "none");
+	RsvgHandle *ret=style_shape_svg_new(style, source);
+	g_free(source);
+	END_FUNC
+	return ret;
+}
+
+/* liberate memory used by the rasterized layers */
+void style_layers_free(gpointer data)
+{
+	START_FUNC
+	struct style_layers *layers=(struct style_layers *)data;
+	if (layers->fill) cairo_surface_destroy(layers->fill);
+	if (layers->outline) cairo_surface_destroy(layers->outline);
+	if (layers->overlay) cairo_surface_destroy(layers->overlay);
+	g_free(layers);
+	END_FUNC
+}
+
+/* rasterize a layer of the shape to a new image surface */
+cairo_surface_t *style_layer_render(RsvgHandle *svg, cairo_format_t format, gint w, gint h)
+{
+	START_FUNC
+	cairo_surface_t *surface=cairo_image_surface_create(format, w, h);
+	cairo_t *ctx=cairo_create(surface);
+	style_render_svg(ctx, svg, (gdouble)w, (gdouble)h, FALSE, NULL);
+	cairo_destroy(ctx);
+	END_FUNC
+	return surface;
+}
+
+/* get the colour independent layers of the shape at size w x h pixels */
+struct style_layers *style_shape_layers_get(struct style *style, struct shape *shape, gint w, gint h)
+{
+	START_FUNC
+	struct style_layers *layers;
+	if (!shape->fill) {
+		shape->fill=style_shape_layer_new(style, shape, "#000000", "none");
+		shape->outline=style_shape_layer_new(style, shape, "none", "#000000");
+		shape->overlay=style_shape_layer_new(style, shape, "none", "none");
+	}
+	if (!shape->layers) shape->layers=g_hash_table_new_full(g_direct_hash, g_direct_equal,
+		NULL, style_layers_free);
+	layers=(struct style_layers *)g_hash_table_lookup(shape->layers, STYLE_ATLAS_KEY(0, w, h));
+	if (!layers) {
+		layers=g_malloc(sizeof(struct style_layers));
+		layers->fill=style_layer_render(shape->fill, CAIRO_FORMAT_A8, w, h);
+		layers->outline=style_layer_render(shape->outline, CAIRO_FORMAT_A8, w, h);
+		layers->overlay=style_layer_render(shape->overlay, CAIRO_FORMAT_ARGB32, w, h);
+		g_hash_table_insert(shape->layers, STYLE_ATLAS_KEY(0, w, h), (gpointer)layers);
+	}
+	END_FUNC
+	return layers;
+}
+
+/* render the shape to the cairo context at w x h pixels. */
+void style_shape_render(struct style *style, struct shape *shape, cairo_t *cairoctx,
+	gint w, gint h, enum style_colours c)
+{
+	START_FUNC
+	gchar *source;
+	RsvgHandle *svg;
+	struct style_layers *layers;
+	if (settings_get_bool(SETTINGS_TINT_SHAPES)) {
+		/* tint the colour independent layers */
+		layers=style_shape_layers_get(style, shape, w, h);
+		style_cairo_set_color(cairoctx, c);
+		cairo_mask_surface(cairoctx, layers->fill, 0.0, 0.0);
+		style_cairo_set_color(cairoctx, STYLE_OUTLINE_COLOR);
+		cairo_mask_surface(cairoctx, layers->outline, 0.0, 0.0);
+		cairo_set_source_surface(cairoctx, layers->overlay, 0.0, 0.0);
+		cairo_paint(cairoctx);
+	} else if (c==STYLE_KEY_COLOR) {
+		style_render_svg(cairoctx, style_shape_svg_get(shape), (gdouble)w, (gdouble)h, FALSE, NULL);
 	} else {
-		svg=rsvg_handle_new();
-		if (style->base_uri) rsvg_handle_set_base_uri(svg, style->base_uri);
-		else {
-			default_uri=settings_get_string(SETTINGS_STYLE_ITEM);
-			rsvg_handle_set_base_uri(svg, default_uri);
-			if (default_uri) g_free(default_uri);
-		}
 		source=style_svg_css_insert((gchar *)shape->source, c);
-		rsvg_handle_write(svg, (guchar *)source, (gsize)strlen(source), &error);
-		rsvg_handle_close(svg, &error);
-		style_render_svg(cairoctx, svg, w, h, FALSE, NULL);
-		if (source) g_free(source);
-		if (svg) g_object_unref(G_OBJECT(svg));
+		svg=style_shape_svg_new(style, source);
+		style_render_svg(cairoctx, svg, (gdouble)w, (gdouble)h, FALSE, NULL);
+		g_free(source);
+		g_object_unref(G_OBJECT(svg));
+	}
+	END_FUNC
+}
+
+/* draw the shape to the cairo context.
+ * The shape is rasterized once per colour and size in pixels, then copied from the atlas. */
+void style_shape_draw(struct style *style, struct shape *shape, cairo_t *cairoctx,
+	gdouble w, gdouble h, enum style_colours c)
+{
+	START_FUNC
+	cairo_surface_t *surface;
+	cairo_t *ctx;
+	gdouble x=0.0, y=0.0;
+	gint pw, ph;
+
+	/* position and size of the shape in pixels */
+	cairo_user_to_device(cairoctx, &x, &y);
+	cairo_user_to_device_distance(cairoctx, &w, &h);
+	pw=(gint)floor(fabs(w)+0.5); ph=(gint)floor(fabs(h)+0.5);
+	if ((pw>0) && (ph>0)) {
+		if (!shape->atlas) shape->atlas=g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify)cairo_surface_destroy);
+		surface=(cairo_surface_t *)g_hash_table_lookup(shape->atlas, STYLE_ATLAS_KEY(c, pw, ph));
+		if (!surface) {
+			surface=cairo_surface_create_similar(cairo_get_target(cairoctx),
+				CAIRO_CONTENT_COLOR_ALPHA, pw, ph);
+			ctx=cairo_create(surface);
+			style_shape_render(style, shape, ctx, pw, ph, c);
+			style_cairo_status_check(ctx);
+			cairo_destroy(ctx);
+			g_hash_table_insert(shape->atlas, STYLE_ATLAS_KEY(c, pw, ph), (gpointer)surface);
+		}
+		cairo_save(cairoctx);
+		cairo_identity_matrix(cairoctx);
+		cairo_set_source_surface(cairoctx, surface, floor(x+0.5), floor(y+0.5));
+		cairo_paint(cairoctx);
+		cairo_restore(cairoctx);
 	}
 	END_FUNC
 }
 
-/* create a mask surface for the shape, if it doesn't already exist */
-cairo_surface_t *style_shape_get_mask(struct shape *shape, guint w, guint h)
+/* liberate the memory used by a hit mask */
+void style_mask_free(gpointer data)
+{
+	START_FUNC
+	struct style_mask *mask=(struct style_mask *)data;
+	if (mask->rows) g_free(mask->rows);
+	if (mask->bits) g_free(mask->bits);
+	g_free(mask);
+	END_FUNC
+}
+
+/* render the hit mask of a shape at a size in pixels */
+struct style_mask *style_mask_new(struct shape *shape, guint w, guint h)
 {
 	START_FUNC
+	struct style_mask *mask=g_malloc(sizeof(struct style_mask));
+	GByteArray *bits;
+	cairo_surface_t *surface;
 	cairo_t *maskctx;
-	if ((!shape->mask)||(w!=shape->maskw)||(h!=shape->maskh)) {
-		if (shape->mask) cairo_surface_destroy(shape->mask);
-		shape->maskw=w; shape->maskh=h;
-		shape->mask=cairo_image_surface_create(CAIRO_FORMAT_A8, w, h);
-		maskctx=cairo_create(shape->mask);
-		style_render_svg(maskctx, shape->svg, w, h, FALSE, NULL);
+	guchar *data, *row;
+	guint stride, rowsize, x, y, last=0;
+
+	memset(mask, 0, sizeof(struct style_mask));
+	mask->w=w; mask->h=h;
+	if (w && h) {
+		surface=cairo_image_surface_create(CAIRO_FORMAT_A8, w, h);
+		maskctx=cairo_create(surface);
+		style_render_svg(maskctx, style_shape_svg_get(shape), w, h, FALSE, NULL);
 		cairo_destroy(maskctx);
+		cairo_surface_flush(surface);
+		data=cairo_image_surface_get_data(surface);
+		stride=cairo_image_surface_get_stride(surface);
+
+		rowsize=(w+7)/8;
+		row=g_malloc(rowsize);
+		bits=g_byte_array_new();
+		mask->rows=g_malloc(sizeof(guint)*h);
+		for (y=0; y<h; y++) {
+			memset(row, 0, rowsize);
+			for (x=0; x<w; x++)
+				if (data[(y*stride)+x]>127) row[x>>3]|=1<<(x&7);
+			/* identical consecutive rows share their bits */
+			if (y && !memcmp(bits->data+last, row, rowsize)) mask->rows[y]=last;
+			else {
+				last=mask->rows[y]=bits->len;
+				g_byte_array_append(bits, row, rowsize);
+			}
+		}
+		g_free(row);
+		mask->bits=g_byte_array_free(bits, FALSE);
+		cairo_surface_destroy(surface);
 	}
 	END_FUNC
-	return shape->mask;
+	return mask;
+}
+
+/* get the hit mask of the shape at a size in pixels */
+struct style_mask *style_shape_mask_get(struct shape *shape, guint w, guint h)
+{
+	START_FUNC
+	struct style_mask *mask;
+	if (!shape->masks) shape->masks=g_hash_table_new_full(g_direct_hash, g_direct_equal,
+		NULL, style_mask_free);
+	mask=(struct style_mask *)g_hash_table_lookup(shape->masks, STYLE_ATLAS_KEY(0, w, h));
+	if (!mask) {
+		mask=style_mask_new(shape, w, h);
+		g_hash_table_insert(shape->masks, STYLE_ATLAS_KEY(0, w, h), (gpointer)mask);
+	}
+	END_FUNC
+	return mask;
+}
+
+/* compute the hit mask of the shape at a size in advance */
+void style_shape_mask_prepare(struct shape *shape, guint w, guint h)
+{
+	START_FUNC
+	style_shape_mask_get(shape, w, h);
+	END_FUNC
 }
 
 /* test if point is inside the mask */
 gboolean style_shape_test(struct shape *shape, gint x, gint y, guint w, guint h)
 {
 	START_FUNC
-	cairo_surface_t *mask=style_shape_get_mask(shape, w, h);
-	unsigned char *data=cairo_image_surface_get_data(mask);
-	int stride=cairo_image_surface_get_stride(mask);
+	struct style_mask *mask;
+	gboolean ret=FALSE;
+	if ((x>=0) && (y>=0) && (x<w) && (y<h)) {
+		mask=style_shape_mask_get(shape, w, h);
+		ret=(mask->bits[mask->rows[y]+(x>>3)]>>(x&7))&1;
+	}
+	END_FUNC
+	return ret;
+}
+
+/* forget the svg handle of one item: it is created again with the new colours on first use */
+void style_update_color (RsvgHandle **svg)
+{
+	START_FUNC
+	if (*svg) g_object_unref(G_OBJECT(*svg));
+	*svg=NULL;
 	END_FUNC
-	return (x>=0) && (y>=0) && (x<w) && (y<h) && data[(y*stride)+x]>127;
 }
 
-/* update the color of one item */
-void style_update_color (gchar *source, RsvgHandle **svg, gchar *default_uri)
+/* forget the rasterized shapes and layers (to call when the scale changes) */
+void style_atlas_flush(struct style *style)
 {
 	START_FUNC
-	GError *error=NULL;
-	gchar *source_with_css;
-	if (*svg) {
-		g_object_unref(G_OBJECT(*svg));
-		source_with_css=style_svg_css_insert(source, STYLE_KEY_COLOR);
-		*svg=rsvg_handle_new();
-		if (default_uri) rsvg_handle_set_base_uri(*svg, default_uri);
-		rsvg_handle_write(*svg, (guchar *)source_with_css,
-			(gsize)strlen((gchar *)source_with_css), &error);
-		rsvg_handle_close(*svg, &error);
-		if (error) flo_fatal(_("Unable to parse svg from layout file: %s"), source_with_css);
-		if (source_with_css) g_free(source_with_css);
+	GSList *list=style->shapes;
+	struct shape *shape;
+	while (list) {
+		shape=(struct shape *)list->data;
+		if (shape->atlas) g_hash_table_remove_all(shape->atlas);
+		if (shape->layers) g_hash_table_remove_all(shape->layers);
+		if (shape->masks) g_hash_table_remove_all(shape->masks);
+		list=g_slist_next(list);
 	}
 	END_FUNC
 }
@@ -516,31 +874,28 @@ void style_update_colors (struct style *style)
 	GSList *list;
 	struct symbol *symbol;
 	struct shape *shape;
-	gchar *default_uri;
+	guint i;
 
 	list=style->symbols;
 	while (list) {
 		symbol=(struct symbol *)list->data;
-		style_update_color(symbol->source, &(symbol->svg), NULL);
+		style_update_color(&(symbol->svg));
 		list=g_slist_next(list);
 	}
 
-	list=style->type_symbols;
-	while (list) {
-		symbol=(struct symbol *)list->data;
-		style_update_color(symbol->source, &(symbol->svg), NULL);
-		list=g_slist_next(list);
+	for (i=0; i<KEY_ACTION_TYPE_NUM; i++) {
+		symbol=style->type_symbols[i];
+		if (symbol) style_update_color(&(symbol->svg));
 	}
 
+	/* tinted shapes only need to be composited again */
 	list=style->shapes;
-	default_uri=settings_get_string(SETTINGS_STYLE_ITEM);
 	while (list) {
 		shape=(struct shape *)list->data;
-		style_update_color((gchar *)shape->source, &(shape->svg),
-			style->base_uri?style->base_uri:default_uri);
+		if (!settings_get_bool(SETTINGS_TINT_SHAPES)) style_update_color(&(shape->svg));
+		if (shape->atlas) g_hash_table_remove_all(shape->atlas);
 		list=g_slist_next(list);
 	}
-	if (default_uri) g_free(default_uri);
 	END_FUNC
 }
 
@@ -550,56 +905,13 @@ GdkPixbuf *style_pixbuf_draw(struct style *style)
 {
 	START_FUNC
 	struct shape *shape=style_shape_get(style, NULL);
-	GdkPixbuf *temp=rsvg_handle_get_pixbuf(shape->svg);
+	GdkPixbuf *temp=rsvg_handle_get_pixbuf(style_shape_svg_get(shape));
 	GdkPixbuf *ret=gdk_pixbuf_scale_simple(temp, 32, 32, GDK_INTERP_HYPER);
 	g_object_unref(G_OBJECT(temp));
 	END_FUNC
 	return ret;
 }
 
-/* Liberate the pipeline */
-void style_sound_pipeline_free(GstElement *pipeline)
-{
-	START_FUNC
-	gst_element_set_state(GST_ELEMENT(pipeline), GST_STATE_NULL);
-	gst_object_unref(GST_OBJECT(pipeline));
-	END_FUNC
-}
-
-/* Called on sound event */
-static gboolean style_sound_bus_call(GstBus *bus, GstMessage *msg, void *user_data)
-{
-	GError *err;
-	switch GST_MESSAGE_TYPE(msg) {
-		case GST_MESSAGE_ERROR:
-			gst_message_parse_error(msg, &err, NULL);
-			flo_error(_("An error occured while playing sound: %s"), err->message);
-			g_error_free(err);
-		case GST_MESSAGE_EOS:
-			style_sound_pipeline_free((GstElement *)user_data);
-			break;
-		default: break;
-	}
-	return TRUE;
-}
-
-/* Initialize the pipeline to play a sound */
-GstElement *style_sound_setup(const gchar *uri)
-{
-	START_FUNC
-	GstElement *pipeline=NULL;
-	GstBus *bus;
-	if (uri) {
-		pipeline=gst_element_factory_make("playbin", "player");
-		g_object_set(G_OBJECT(pipeline), "uri", uri, NULL);
-		bus=gst_pipeline_get_bus(GST_PIPELINE(pipeline));
-		gst_bus_add_watch(bus, style_sound_bus_call, (gpointer)pipeline);
-		gst_object_unref(bus);
-	}
-	END_FUNC
-	return pipeline;
-}
-
 /* create a new sound */
 void style_sound_new(struct style *style, char *match, char *press, char *release, char *hover)
 {
@@ -613,7 +925,8 @@ void style_sound_new(struct style *style, char *match, char *press, char *releas
 	if (press) sound->press=g_strdup(press);
 	if (release) sound->release=g_strdup(release);
 	if (hover) sound->hover=g_strdup(hover);
-	style->sounds=g_slist_append(style->sounds, (gpointer)sound);
+	/* the list is reversed once the style is loaded */
+	style->sounds=g_slist_prepend(style->sounds, (gpointer)sound);
 	flo_debug(TRACE_DEBUG, "[new sound] match=%s press=%s release=%s hover=%s", match, press, release, hover);
 	END_FUNC
 }
@@ -649,25 +962,61 @@ gboolean style_sound_matches(struct sound *sound, const gchar *name)
 	return ret;
 }
 
-/* play a sound */
-void style_sound_play(struct style *style, const gchar *match, enum style_sound_type type)
+/* get the sound matching the name: the sounds are looked up once per name */
+struct sound *style_sound_get(struct style *style, const gchar *name)
 {
 	START_FUNC
 	struct sound *sound=NULL;
-	GstElement *pipeline=NULL;
-	GSList *item=style->sounds;
-	while (item && !style_sound_matches((struct sound *)item->data, match)) {
-		item=g_slist_next(item);
+	gpointer value;
+	GSList *item;
+	if (g_hash_table_lookup_extended(style->sound_index, name, NULL, &value))
+		sound=(struct sound *)value;
+	else {
+		for (item=style->sounds; item && !style_sound_matches((struct sound *)item->data, name);
+			item=g_slist_next(item));
+		if (item) sound=(struct sound *)item->data;
+		g_hash_table_insert(style->sound_index, g_strdup(name), sound);
 	}
-	if (item) {
-		sound=(struct sound *)item->data;
+	END_FUNC
+	return sound;
+}
+
+/* create the audio engine and decode the sounds when the sounds are enabled,
+ * free it when they are disabled. Only the style of the keyboard needs it. */
+void style_sound_update(struct style *style)
+{
+	START_FUNC
+	GSList *item;
+	struct sound *sound;
+	if (!settings_get_bool(SETTINGS_SOUNDS)) {
+		if (style->audio) audio_free(style->audio);
+		style->audio=NULL;
+	} else if (style->sounds && !style->audio) {
+		style->audio=audio_new();
+		/* decode the sounds now rather than on the first key press */
+		for (item=style->sounds; item; item=g_slist_next(item)) {
+			sound=(struct sound *)item->data;
+			audio_load(style->audio, sound->press);
+			audio_load(style->audio, sound->release);
+			audio_load(style->audio, sound->hover);
+		}
+	}
+	END_FUNC
+}
+
+/* play a sound */
+void style_sound_play(struct style *style, const gchar *match, enum style_sound_type type)
+{
+	START_FUNC
+	struct sound *sound=match?style_sound_get(style, match):NULL;
+	if (sound && !style->audio) style_sound_update(style);
+	if (sound && style->audio) {
 		switch(type) {
-			case STYLE_SOUND_PRESS: pipeline=style_sound_setup(sound->press); break;
-			case STYLE_SOUND_RELEASE: pipeline=style_sound_setup(sound->release); break;
-			case STYLE_SOUND_HOVER: pipeline=style_sound_setup(sound->hover); break;
+			case STYLE_SOUND_PRESS: audio_play(style->audio, sound->press); break;
+			case STYLE_SOUND_RELEASE: audio_play(style->audio, sound->release); break;
+			case STYLE_SOUND_HOVER: audio_play(style->audio, sound->hover); break;
 			default: flo_error(_("Unknown sound type: %d"), type);
 		};
-		if (pipeline) { gst_element_set_state(GST_ELEMENT(pipeline), GST_STATE_PLAYING); }
 	}
 	END_FUNC
 }
@@ -682,39 +1031,50 @@ struct style *style_new(gchar *base_uri)
 	struct layout_sound *sound=NULL;
 	struct style *style=g_malloc(sizeof(struct style));
 	char *uri=base_uri;
+	const char *name;
 
 	memset(style, 0, sizeof(struct style));
 	style->base_uri=base_uri;
+	/* key.h may include this file before defining KEY_ACTION_TYPE_NUM: the array is allocated here */
+	style->type_symbols=g_malloc(KEY_ACTION_TYPE_NUM*sizeof(struct symbol *));
+	memset(style->type_symbols, 0, KEY_ACTION_TYPE_NUM*sizeof(struct symbol *));
+	style->shape_index=g_hash_table_new(g_str_hash, g_str_equal);
+	style->symbol_names=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	style->symbol_index=g_hash_table_new(g_direct_hash, g_direct_equal);
+	style->sound_index=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	style->labels=g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify)cairo_path_destroy);
 	if (!uri) uri=settings_get_string(SETTINGS_STYLE_ITEM);
 	layout=layoutreader_new(uri,
 		DATADIR "/styles/default/florence.style",
 		DATADIR "/relaxng/style.rng");
 
-	layoutreader_element_open(layout, "style");
-	if (layoutreader_element_open(layout, "shapes")) {
-		while ((shape=layoutreader_shape_new(layout))) {
-			style_shape_new(style, shape->name, shape->svg);
-			layoutreader_shape_free(shape);
-		}
-	}
-
-	layoutreader_reset(layout);
-	layoutreader_element_open(layout, "style");
-	if (layoutreader_element_open(layout, "symbols")) {
-		while ((symbol=layoutreader_symbol_new(layout))) {
-			style_symbol_new(style, symbol->name, symbol->svg, symbol->label, symbol->type);
-			layoutreader_symbol_free(symbol);
-		}
-	}
-
-	layoutreader_reset(layout);
-	layoutreader_element_open(layout, "style");
-	if (layoutreader_element_open(layout, "sounds")) {
-		while ((sound=layoutreader_sound_new(layout))) {
-			style_sound_new(style, sound->match, sound->press, sound->release, sound->hover);
-			layoutreader_sound_free(sound);
+	/* read the shapes, symbols and sounds in a single pass */
+	if (layoutreader_element_open(layout, "style")) {
+		while ((name=layoutreader_child_open(layout))) {
+			if (!strcmp(name, "shapes")) {
+				while ((shape=layoutreader_shape_new(layout))) {
+					style_shape_new(style, shape->name, shape->svg);
+					layoutreader_shape_free(shape);
+				}
+			} else if (!strcmp(name, "symbols")) {
+				while ((symbol=layoutreader_symbol_new(layout))) {
+					style_symbol_new(style, symbol->name, symbol->svg, symbol->label, symbol->type);
+					layoutreader_symbol_free(symbol);
+				}
+			} else if (!strcmp(name, "sounds")) {
+				while ((sound=layoutreader_sound_new(layout))) {
+					style_sound_new(style, sound->match, sound->press, sound->release, sound->hover);
+					layoutreader_sound_free(sound);
+				}
+			}
+			layoutreader_child_close(layout);
 		}
 	}
+	style->shapes=g_slist_reverse(style->shapes);
+	style->symbols=g_slist_reverse(style->symbols);
+	style->symbol_patterns=g_slist_reverse(style->symbol_patterns);
+	style->sounds=g_slist_reverse(style->sounds);
 
 	layoutreader_free(layout);
 	if (!base_uri) g_free(uri);
@@ -726,13 +1086,33 @@ struct style *style_new(gchar *base_uri)
 void style_free(struct style *style)
 {
 	START_FUNC
+	guint i;
 	if (style) {
+		flo_debug(TRACE_DEBUG, _("%u svg handles created for %u shapes, %u for %u symbols"),
+			style->shape_svgs, g_slist_length(style->shapes),
+			style->symbol_svgs, g_slist_length(style->symbols));
+		g_hash_table_destroy(style->shape_index);
 		g_slist_foreach(style->shapes, style_shape_free, NULL);
 		g_slist_free(style->shapes);
+		g_hash_table_destroy(style->symbol_names);
+		g_slist_free(style->symbol_patterns);
 		g_slist_foreach(style->symbols, style_symbol_free, NULL);
 		g_slist_free(style->symbols);
+		g_hash_table_destroy(style->symbol_index);
+		g_hash_table_destroy(style->labels);
+		if (style->font_face) cairo_font_face_destroy(style->font_face);
+		for (i=0; i<KEY_ACTION_TYPE_NUM; i++) {
+			if (style->type_symbols[i]) {
+				/* the id of a type symbol is not a regex */
+				style->type_symbols[i]->id.name=NULL;
+				style_symbol_free((gpointer)style->type_symbols[i], NULL);
+			}
+		}
+		g_free(style->type_symbols);
 		g_slist_foreach(style->sounds, style_sound_free, NULL);
 		g_slist_free(style->sounds);
+		g_hash_table_destroy(style->sound_index);
+		if (style->audio) audio_free(style->audio);
 		g_free(style);
 	}
 	END_FUNC
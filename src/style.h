@@ -29,14 +29,19 @@
 #include "key.h"
 
 enum key_action_type;
+struct symbol;
+struct audio;
 
 /* a shape is the background of a key */
 struct shape {
 	gchar *name;
-	RsvgHandle *svg;
+	struct style *style; /* style the shape belongs to */
+	RsvgHandle *svg; /* created on first use (see style_shape_svg_get) */
 	guchar *source;
-	cairo_surface_t *mask; /* mask of the shape (alpha channel) */
-	guint maskw, maskh; /* size of the mask */
+	GHashTable *masks; /* hit masks by pixel size */
+	GHashTable *atlas; /* rasterized shape by colour and pixel size */
+	RsvgHandle *fill, *outline, *overlay; /* colour independent layers of the shape */
+	GHashTable *layers; /* rasterized layers by pixel size */
 };
 
 /* sound types */
@@ -78,10 +83,22 @@ enum style_class {
 struct style {
 	gchar *base_uri;
 	GSList *symbols; /* list of symbols by keyval */
-	GSList *type_symbols; /* list of symbols by type */
+	guint symbol_count; /* number of symbols by keyval */
+	GHashTable *symbol_names; /* symbols with a plain keyval name by name */
+	GSList *symbol_patterns; /* symbols with a regular expression as name, in style order */
+	GHashTable *symbol_index; /* resolved symbols by keyval (NULL when none matches) */
+	struct symbol **type_symbols; /* symbols by action type (KEY_ACTION_TYPE_NUM items) */
+	cairo_font_face_t *font_face; /* font of the labels */
+	gdouble font_size; /* font size of the labels */
+	GHashTable *labels; /* outlines of the labels by box size and text */
 	GSList *shapes;
+	GHashTable *shape_index; /* shapes by name */
 	GSList *sounds; /* list of sounds */
+	GHashTable *sound_index; /* resolved sounds by name (NULL when none matches) */
+	struct audio *audio; /* engine playing the sounds or NULL (see style_sound_update) */
 	struct shape *default_shape;
+	guint shape_svgs; /* number of svg handles created for the shapes */
+	guint symbol_svgs; /* number of svg handles created for the symbols */
 };
 
 struct style *style_new(gchar *base_uri);
@@ -94,10 +111,16 @@ GdkPixbuf *style_pixbuf_draw(struct style *style);
 void style_cairo_set_color(cairo_t *cairoctx, enum style_colours c);
 /* update the colours */
 void style_update_colors(struct style *style);
+/* forget the rasterized shapes and layers (to call when the scale changes) */
+void style_atlas_flush(struct style *style);
+/* forget the font and the label outlines (to call when the font changes) */
+void style_font_flush(struct style *style);
 
 struct shape *style_shape_get(struct style *style, gchar *name);
 void style_shape_draw(struct style *style, struct shape *shape, cairo_t *cairoctx,
 	gdouble w, gdouble h, enum style_colours c);
+/* compute the hit mask of the shape at a size in advance */
+void style_shape_mask_prepare(struct shape *shape, guint w, guint h);
 /* test if point is inside the mask */
 gboolean style_shape_test(struct shape *shape, gint x, gint y, guint w, guint h);
 /* Draw the symbol represented by keyval */
@@ -106,6 +129,9 @@ void style_symbol_draw(struct style *style, cairo_t *cairoctx, guint keyval, gdo
 void style_symbol_type_draw(struct style *style, cairo_t *cairoctx, enum key_action_type type, gdouble w, gdouble h);
 /* Draws text with cairo */
 void style_draw_text(struct style *style, cairo_t *cairoctx, gchar *text, gdouble w, gdouble h);
+/* create the audio engine when the sounds are enabled, free it when they are disabled
+ * (to call for the style of the keyboard and when the sounds setting changes) */
+void style_sound_update(struct style *style);
 /* play a sound */
 void style_sound_play(struct style *style, const gchar *match, enum style_sound_type type);
 
@@ -25,6 +25,7 @@
 #include "settings.h"
 #include "keyboard.h"
 #include "tools.h"
+#include <math.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
 #include <cairo/cairo-xlib.h>
@@ -107,8 +108,16 @@ void view_resize (struct view *view)
 	END_FUNC
 }
 
+/* a symbols image drawn for a modifier state */
+struct view_symbols {
+	GdkModifierType globalmod; /* global modifiers the image is drawn with */
+	guint group; /* xkb group the image is drawn with */
+	cairo_surface_t *surface; /* the symbols image */
+};
+
 /* draws the background of florence */
-void view_draw (struct view *view, cairo_t *cairoctx, cairo_surface_t **surface, enum style_class class)
+void view_draw (struct view *view, cairo_t *cairoctx, cairo_surface_t **surface,
+	enum style_class class, GdkModifierType globalmod, guint group)
 {
 	START_FUNC
 	GSList *list=view->keyboards;
@@ -144,7 +153,8 @@ void view_draw (struct view *view, cairo_t *cairoctx, cairo_surface_t **surface,
 					}
 					break;
 				case STYLE_SYMBOL:
-					keyboard_symbols_draw(keyboard, offscreen, view->style, view->status);
+					keyboard_symbols_draw(keyboard, offscreen, view->style, view->status,
+						globalmod, group);
 					break;
 			}
 		}
@@ -158,15 +168,208 @@ void view_draw (struct view *view, cairo_t *cairoctx, cairo_surface_t **surface,
 void view_background_draw (struct view *view, cairo_t *cairoctx)
 {
 	START_FUNC
-	view_draw(view, cairoctx, &(view->background), STYLE_SHAPE);
+	view_draw(view, cairoctx, &(view->background), STYLE_SHAPE, status_globalmod_get(view->status),
+		xkeyboard_group_get(view->status->xkeyboard));
+	END_FUNC
+}
+
+/* liberate the memory used by a symbols image */
+void view_symbols_free (gpointer data)
+{
+	START_FUNC
+	struct view_symbols *symbols=(struct view_symbols *)data;
+	if (symbols->surface) cairo_surface_destroy(symbols->surface);
+	g_free(symbols);
+	END_FUNC
+}
+
+/* find the symbols image of a modifier state in the cache */
+GList *view_symbols_find (struct view *view, GdkModifierType globalmod, guint group)
+{
+	START_FUNC
+	GList *list=view->symbols_cache;
+	struct view_symbols *symbols;
+	while (list) {
+		symbols=(struct view_symbols *)list->data;
+		if ((symbols->globalmod==globalmod) && (symbols->group==group)) break;
+		list=list->next;
+	}
+	END_FUNC
+	return list;
+}
+
+/* return TRUE if count more symbols images fit in the cache memory */
+gboolean view_symbols_room (struct view *view, guint count)
+{
+	START_FUNC
+	gsize size=(gsize)view->width*view->height*4;
+	gsize max=(gsize)MAX(settings_get_int(SETTINGS_SYMBOLS_CACHE), 0)*1024*1024;
 	END_FUNC
+	return ((g_list_length(view->symbols_cache)+count)*size)<=max;
+}
+
+/* make the symbols image the current one and drop the least recently used images */
+void view_symbols_select (struct view *view, struct view_symbols *symbols)
+{
+	START_FUNC
+	GList *last;
+	GList *found=g_list_find(view->symbols_cache, symbols);
+	if (found) view->symbols_cache=g_list_delete_link(view->symbols_cache, found);
+	view->symbols_cache=g_list_prepend(view->symbols_cache, symbols);
+	view->symbols=symbols->surface;
+	while (view->symbols_cache->next && !view_symbols_room(view, 0)) {
+		last=g_list_last(view->symbols_cache);
+		view_symbols_free(last->data);
+		view->symbols_cache=g_list_delete_link(view->symbols_cache, last);
+	}
+	END_FUNC
+}
+
+/* draws the symbols of a modifier state to a new image */
+struct view_symbols *view_symbols_new (struct view *view, cairo_surface_t *surface,
+	GdkModifierType globalmod, guint group)
+{
+	START_FUNC
+	struct view_symbols *symbols=g_malloc(sizeof(struct view_symbols));
+	symbols->globalmod=globalmod;
+	symbols->group=group;
+	symbols->surface=surface;
+	view_draw(view, NULL, &(symbols->surface), STYLE_SYMBOL, globalmod, group);
+	END_FUNC
+	return symbols;
 }
 
 /* draws the symbols */
 void view_symbols_draw (struct view *view, cairo_t *cairoctx)
 {
 	START_FUNC
-	view_draw(view, cairoctx, &(view->symbols), STYLE_SYMBOL);
+	GdkModifierType globalmod=status_globalmod_get(view->status);
+	guint group=xkeyboard_group_get(view->status->xkeyboard);
+	GList *found=view_symbols_find(view, globalmod, group);
+	if (found) view_symbols_select(view, (struct view_symbols *)found->data);
+	else view_symbols_select(view, view_symbols_new(view,
+		cairo_surface_create_similar(cairo_get_target(cairoctx), CAIRO_CONTENT_COLOR_ALPHA,
+			view->width, view->height), globalmod, group));
+	END_FUNC
+}
+
+/* draws the symbols images of the common modifier states in idle time:
+ * the states of the current group first, then the other xkb groups state by state */
+gboolean view_symbols_prewarm (gpointer user_data)
+{
+	START_FUNC
+	static const GdkModifierType states[]={ 0, GDK_SHIFT_MASK, GDK_LOCK_MASK, GDK_MOD5_MASK };
+	struct view *view=(struct view *)user_data;
+	GdkWindow *window=gtk_widget_get_window(GTK_WIDGET(view->window));
+	gboolean ret=FALSE, found=FALSE;
+	guint current, count, group, i, j;
+	if (window && view->width && view->height) {
+		current=xkeyboard_group_get(view->status->xkeyboard);
+		count=MAX(g_list_length(view->status->xkeyboard->groups), 1);
+		for (i=0; (!found) && i<G_N_ELEMENTS(states)*count; i++) {
+			/* i < number of states: current group. Otherwise the other groups */
+			if (i<G_N_ELEMENTS(states)) { group=current; j=i; }
+			else {
+				group=(current+1+((i-G_N_ELEMENTS(states))%(count-1)))%count;
+				j=(i-G_N_ELEMENTS(states))/(count-1);
+			}
+			if (!view_symbols_find(view, states[j], group)) {
+				found=TRUE;
+				/* one image per idle call */
+				if (view_symbols_room(view, 1)) {
+					view->symbols_cache=g_list_append(view->symbols_cache,
+						view_symbols_new(view, gdk_window_create_similar_surface(window,
+							CAIRO_CONTENT_COLOR_ALPHA, view->width, view->height),
+							states[j], group));
+					ret=TRUE;
+				}
+			}
+		}
+	}
+	if (!ret) view->prewarm_id=0;
+	END_FUNC
+	return ret;
+}
+
+/* forget the focus key images of the timer input method */
+void view_timer_flush (struct view *view)
+{
+	START_FUNC
+	if (view->timer.idle) cairo_surface_destroy(view->timer.idle);
+	if (view->timer.active) cairo_surface_destroy(view->timer.active);
+	view->timer.idle=view->timer.active=NULL;
+	view->timer.key=NULL;
+	END_FUNC
+}
+
+/* forget the symbols images and start drawing the common ones again */
+void view_symbols_flush (struct view *view)
+{
+	START_FUNC
+	view_timer_flush(view);
+	g_list_free_full(view->symbols_cache, view_symbols_free);
+	view->symbols_cache=NULL;
+	view->symbols=NULL;
+	if (!view->prewarm_id)
+		view->prewarm_id=g_idle_add_full(G_PRIORITY_LOW, view_symbols_prewarm, view, NULL);
+	END_FUNC
+}
+
+/* update the symbols to the global modifiers and the xkb group.
+ * Use the cached image of the state if any, or redraw the keys changed by the modifiers */
+void view_symbols_update (struct view *view)
+{
+	START_FUNC
+	GSList *list=view->keyboards;
+	struct keyboard *keyboard;
+	struct view_symbols *current=(struct view_symbols *)view->symbols_cache->data;
+	struct view_symbols *symbols=NULL;
+	GdkModifierType globalmod=status_globalmod_get(view->status);
+	GdkModifierType changed=current->globalmod^globalmod;
+	guint group=xkeyboard_group_get(view->status->xkeyboard);
+	GList *found;
+	cairo_region_t *damage;
+	cairo_t *offscreen=NULL;
+
+	if (current->group!=group) {
+		/* the whole layout changed: swap to the image of the group */
+		if ((found=view_symbols_find(view, globalmod, group)))
+			view_symbols_select(view, (struct view_symbols *)found->data);
+		else view_symbols_select(view, view_symbols_new(view,
+			cairo_surface_create_similar(current->surface, CAIRO_CONTENT_COLOR_ALPHA,
+				view->width, view->height), globalmod, group));
+		gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(view->window)), NULL, TRUE);
+	} else if (changed) {
+		if ((found=view_symbols_find(view, globalmod, current->group))) {
+			symbols=(struct view_symbols *)found->data;
+		} else {
+			/* copy the current image and redraw the changed keys */
+			symbols=g_malloc(sizeof(struct view_symbols));
+			symbols->globalmod=globalmod;
+			symbols->group=current->group;
+			symbols->surface=cairo_surface_create_similar(current->surface,
+				CAIRO_CONTENT_COLOR_ALPHA, view->width, view->height);
+			offscreen=cairo_create(symbols->surface);
+			cairo_set_source_surface(offscreen, current->surface, 0, 0);
+			cairo_set_operator(offscreen, CAIRO_OPERATOR_SOURCE);
+			cairo_paint(offscreen);
+			cairo_set_operator(offscreen, CAIRO_OPERATOR_OVER);
+			cairo_scale(offscreen, view->scalex, view->scaley);
+		}
+		damage=cairo_region_create();
+		while (list)
+		{
+			keyboard=(struct keyboard *)list->data;
+			if (keyboard_activated(keyboard))
+				keyboard_symbols_update(keyboard, offscreen, view->style, view->status,
+					changed, damage);
+			list=list->next;
+		}
+		if (offscreen) cairo_destroy(offscreen);
+		view_symbols_select(view, symbols);
+		gdk_window_invalidate_region(gtk_widget_get_window(GTK_WIDGET(view->window)), damage, TRUE);
+		cairo_region_destroy(damage);
+	}
 	END_FUNC
 }
 
@@ -228,6 +431,43 @@ void view_keyboards_set_pos(struct view *view, struct keyboard *over)
 	END_FUNC
 }
 
+/* build the hit test grids of the keyboards for the current scale */
+void view_grid_update(struct view *view)
+{
+	START_FUNC
+	GSList *list=view->keyboards;
+	while (list) {
+		if (keyboard_activated((struct keyboard *)list->data))
+			keyboard_grid_update((struct keyboard *)list->data, view->scalex, view->scaley);
+		list=list->next;
+	}
+	END_FUNC
+}
+
+/* compute the hit masks of one keyboard per idle call */
+gboolean view_masks_prepare(gpointer user_data)
+{
+	START_FUNC
+	struct view *view=(struct view *)user_data;
+	struct keyboard *keyboard=(struct keyboard *)g_slist_nth_data(view->keyboards, view->masks_next++);
+	if (keyboard) {
+		if (keyboard_activated(keyboard))
+			keyboard_masks_prepare(keyboard, view->scalex, view->scaley);
+	} else view->masks_id=0;
+	END_FUNC
+	return keyboard!=NULL;
+}
+
+/* compute the hit masks again for the current scale when idle */
+void view_masks_update(struct view *view)
+{
+	START_FUNC
+	view->masks_next=0;
+	if (!view->masks_id)
+		view->masks_id=g_idle_add_full(G_PRIORITY_LOW, view_masks_prepare, view, NULL);
+	END_FUNC
+}
+
 /* calculate the dimensions of Florence */
 void view_set_dimensions(struct view *view)
 {
@@ -270,6 +510,7 @@ void view_set_dimensions(struct view *view)
 	view->width=(guint)(view->vwidth*view->scalex);
 	view->height=(guint)(view->vheight*view->scaley);
 	view_keyboards_set_pos(view, over);
+	view_grid_update(view);
 	END_FUNC
 }
 
@@ -283,9 +524,27 @@ struct key *view_hit_get (struct view *view, gint x, gint y)
 	START_FUNC
 	GSList *list=view->keyboards;
 	struct keyboard *keyboard;
-	struct key *key;
+	struct key *key=status_focus_get(view->status);
 	gint kx, ky, kw, kh;
 
+	/* the pointer is most likely still on the focus key */
+	if (key) {
+		keyboard=(struct keyboard *)key_get_keyboard(key);
+		if (keyboard_activated(keyboard) && (!keyboard->under)) {
+			kx=keyboard->xpos*view->scalex;
+			ky=keyboard->ypos*view->scaley;
+#ifdef ENABLE_RAMBLE
+			if ((kh=key_hit(key, x-kx, y-ky, view->scalex, view->scaley))) {
+				if (hit) *hit=kh;
+#else
+			if (key_hit(key, x-kx, y-ky, view->scalex, view->scaley)) {
+#endif
+				END_FUNC
+				return key;
+			}
+		}
+	}
+
 	/* find the hit keyboard */
 	while (list)
 	{
@@ -410,12 +669,13 @@ void view_redraw(GSettings *settings, gchar *key, gpointer user_data)
 	START_FUNC
 	struct view *view=(struct view *)user_data;
 	style_update_colors(view->style);
-	if ((!strcmp(key, "key")) || (!strcmp(key, "outline"))) {
+	view_timer_flush(view);
+	if ((!strcmp(key, "key")) || (!strcmp(key, "outline")) || (!strcmp(key, "tint-shapes"))) {
 		if (view->background) cairo_surface_destroy(view->background);
 		view->background=NULL;
-	} else if (!strncmp(key, "label", 5) || (!strcmp(key, "font")) || (!strcmp(key, "system_font"))) {
-		if (view->symbols) cairo_surface_destroy(view->symbols);
-		view->symbols=NULL;
+	} else if (!strncmp(key, "label", 5) || (!strcmp(key, "font")) || (!strcmp(key, "system-font"))) {
+		if (strncmp(key, "label", 5)) style_font_flush(view->style);
+		view_symbols_flush(view);
 	}
 	gtk_widget_queue_draw(GTK_WIDGET(view->window));
 	END_FUNC
@@ -443,15 +703,11 @@ void view_update(struct view *view, struct key *key, gboolean statechange)
 	GdkCursor *cursor;
 
 	if (key) {
-		if (statechange) {
-			if (view->symbols) cairo_surface_destroy(view->symbols);
-			view->symbols=NULL;
-			gtk_widget_queue_draw(GTK_WIDGET(view->window));
-		} else {
-			rect=keyboard_key_getrect((struct keyboard *)key_get_keyboard(key),
-				key, status_focus_zoom_get(view->status));
-			gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(view->window)), rect, TRUE);
-		}
+		/* only the symbols of the keys affected by the modifier are redrawn */
+		if (statechange && view->symbols) view_symbols_update(view);
+		rect=keyboard_key_getrect((struct keyboard *)key_get_keyboard(key),
+			key, status_focus_zoom_get(view->status));
+		gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(view->window)), rect, TRUE);
 	}
 	if (status_focus_get(view->status)) {
 		if (!view->hand_cursor) {
@@ -466,6 +722,30 @@ void view_update(struct view *view, struct key *key, gboolean statechange)
 	END_FUNC
 }
 
+/* Redraw the part of the timer wedge of the focus key that changed since it was drawn */
+void view_timer_update(struct view *view)
+{
+	START_FUNC
+	struct key *key=status_focus_get(view->status);
+	gdouble value=MIN(status_timer_get(view->status), 1.0);
+	gdouble x1, y1, x2, y2;
+	GdkRectangle rect;
+	if (!key) {
+		END_FUNC
+		return;
+	}
+	/* the timer only grows: when it is reset, the whole key is redrawn */
+	if (view->timer.idle && (view->timer.key==key) && (value>=view->timer.value)) {
+		key_timer_extents(view->timer.value, value, &x1, &y1, &x2, &y2);
+		rect.x=view->timer.x+(gint)floor(x1*view->timer.w)-1;
+		rect.y=view->timer.y+(gint)floor(y1*view->timer.h)-1;
+		rect.width=(gint)ceil((x2-x1)*view->timer.w)+2;
+		rect.height=(gint)ceil((y2-y1)*view->timer.h)+2;
+		gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(view->window)), &rect, TRUE);
+	} else view_update(view, key, FALSE);
+	END_FUNC
+}
+
 /* on screen change event: check for composite extension */
 void view_screen_changed (GtkWidget *widget, GdkScreen *old_screen, struct view *view)
 {
@@ -516,10 +796,12 @@ void view_configure (GtkWidget *window, GdkEventConfigure* pConfig, struct view
 			settings_set_double(SETTINGS_SCALEY, view->scaley, FALSE);
 		}
 		view->width=pConfig->width; view->height=pConfig->height;
+		view_grid_update(view);
+		style_atlas_flush(view->style);
+		view_masks_update(view);
 		if (view->background) cairo_surface_destroy(view->background);
 		view->background=NULL;
-		if (view->symbols) cairo_surface_destroy(view->symbols);
-		view->symbols=NULL;
+		view_symbols_flush(view);
 		view_create_window_mask(view);
 		rect.x=0; rect.y=0;
 		rect.width=pConfig->width; rect.height=pConfig->height;
@@ -548,8 +830,48 @@ void view_draw_background (struct view *view, cairo_t *context)
 	END_FUNC
 }
 
+/* get the region to redraw from the clip of the draw context.
+ * GDK gathers the invalidated rectangles and the exposures of the window into it.
+ * Returns NULL when the clip can't be represented by rectangles */
+cairo_region_t *view_damage_get(cairo_t *context)
+{
+	START_FUNC
+	cairo_rectangle_list_t *list=cairo_copy_clip_rectangle_list(context);
+	cairo_region_t *damage=NULL;
+	cairo_rectangle_int_t rect;
+	int i;
+	if (list->status==CAIRO_STATUS_SUCCESS) {
+		damage=cairo_region_create();
+		for (i=0; i<list->num_rectangles; i++) {
+			rect.x=floor(list->rectangles[i].x);
+			rect.y=floor(list->rectangles[i].y);
+			rect.width=ceil(list->rectangles[i].x+list->rectangles[i].width)-rect.x;
+			rect.height=ceil(list->rectangles[i].y+list->rectangles[i].height)-rect.y;
+			cairo_region_union_rectangle(damage, &rect);
+		}
+	}
+	cairo_rectangle_list_destroy(list);
+	END_FUNC
+	return damage;
+}
+
+/* return TRUE if the rectangle of the key (zoomed if focused) is in the damaged region */
+gboolean view_key_damaged(struct view *view, cairo_region_t *damage, struct key *key, gboolean focus)
+{
+	START_FUNC
+	GdkRectangle *rect;
+	gboolean ret=TRUE;
+	if (damage) {
+		rect=keyboard_key_getrect((struct keyboard *)key_get_keyboard(key), key,
+			focus && status_focus_zoom_get(view->status));
+		ret=(cairo_region_contains_rectangle(damage, rect)!=CAIRO_REGION_OVERLAP_OUT);
+	}
+	END_FUNC
+	return ret;
+}
+
 /* draw a list of keys (latched or locked keys) */
-void view_draw_list (struct view *view, cairo_t *context, GList *list)
+void view_draw_list (struct view *view, cairo_t *context, GList *list, cairo_region_t *damage)
 {
 	START_FUNC
 	struct keyboard *keyboard;
@@ -557,20 +879,86 @@ void view_draw_list (struct view *view, cairo_t *context, GList *list)
 	while (list) {
 		key=(struct key *)list->data;
 		keyboard=(struct keyboard *)key_get_keyboard(key);
-		keyboard_press_draw(keyboard, context, view->style, key, view->status);
+		if (view_key_damaged(view, damage, key, FALSE))
+			keyboard_press_draw(keyboard, context, view->style, key, view->status);
 		list=list->next;
 	}
 	END_FUNC
 }
 
+/* draw an image of the focus key for the timer input method */
+cairo_surface_t *view_timer_image_new (struct view *view, cairo_t *context, struct key *key,
+	enum style_colours color)
+{
+	START_FUNC
+	cairo_surface_t *surface=cairo_surface_create_similar(cairo_get_target(context),
+		CAIRO_CONTENT_COLOR_ALPHA, view->timer.w, view->timer.h);
+	cairo_t *cairoctx=cairo_create(surface);
+	cairo_scale(cairoctx, view->timer.w/key->w, view->timer.h/key->h);
+	key_layer_draw(key, view->style, cairoctx, view->status, color);
+	cairo_destroy(cairoctx);
+	END_FUNC
+	return surface;
+}
+
+/* draw the focus key with the timer: the part of the key covered by the timer wedge
+ * is taken from the mouse over image, the rest from the idle image */
+void view_timer_draw (struct view *view, cairo_t *context, struct key *key)
+{
+	START_FUNC
+	cairo_matrix_t matrix;
+	GdkModifierType globalmod=status_globalmod_get(view->status);
+	guint group=xkeyboard_group_get(view->status->xkeyboard);
+	gdouble value=status_timer_get(view->status);
+	gint w, h;
+
+	cairo_save(context);
+	keyboard_focus_transform((struct keyboard *)key_get_keyboard(key), context,
+		(gdouble)cairo_xlib_surface_get_width(view->background),
+		(gdouble)cairo_xlib_surface_get_height(view->background), key, view->status);
+	cairo_get_matrix(context, &matrix);
+	w=(gint)ceil(matrix.xx*key->w);
+	h=(gint)ceil(matrix.yy*key->h);
+
+	/* the images are drawn again only when the key looks different */
+	if ((!view->timer.idle) || (view->timer.key!=key) || (view->timer.state!=key->state) ||
+		(view->timer.globalmod!=globalmod) || (view->timer.group!=group) ||
+		(view->timer.w!=w) || (view->timer.h!=h)) {
+		view_timer_flush(view);
+		view->timer.key=key;
+		view->timer.state=key->state;
+		view->timer.globalmod=globalmod;
+		view->timer.group=group;
+		view->timer.w=w;
+		view->timer.h=h;
+		view->timer.idle=view_timer_image_new(view, context, key, key_color_get(key));
+		view->timer.active=view_timer_image_new(view, context, key, STYLE_MOUSE_OVER_COLOR);
+	}
+	/* the images are aligned on the pixels */
+	view->timer.x=(gint)floor(matrix.x0+0.5);
+	view->timer.y=(gint)floor(matrix.y0+0.5);
+	view->timer.value=value;
+
+	cairo_identity_matrix(context);
+	cairo_set_source_surface(context, view->timer.idle, view->timer.x, view->timer.y);
+	cairo_paint(context);
+	key_timer_path(context, view->timer.x, view->timer.y, w, h, 0.0, value);
+	cairo_clip(context);
+	cairo_set_source_surface(context, view->timer.active, view->timer.x, view->timer.y);
+	cairo_paint(context);
+	cairo_restore(context);
+	END_FUNC
+}
+
 /* draw a single key (pressed or focused) */
-void view_draw_key (struct view *view, cairo_t *context, struct key *key)
+void view_draw_key (struct view *view, cairo_t *context, struct key *key, cairo_region_t *damage)
 {
 	START_FUNC
 	struct keyboard *keyboard;
-	if (key) {
+	if (key && view_key_damaged(view, damage, key, TRUE)) {
 		keyboard=(struct keyboard *)key_get_keyboard(key);
-		keyboard_focus_draw(keyboard, context,
+		if (status_timer_get(view->status)>0.0) view_timer_draw(view, context, key);
+		else keyboard_focus_draw(keyboard, context,
 			(gdouble)cairo_xlib_surface_get_width(view->background),
 			(gdouble)cairo_xlib_surface_get_height(view->background),
 			view->style, key, view->status);
@@ -583,6 +971,7 @@ void view_expose (GtkWidget *window, cairo_t* context, struct view *view)
 {
 	START_FUNC
 	enum key_state state;
+	cairo_region_t *damage=view_damage_get(context);
 
 	/* clear the area */
 	if (settings_get_bool(SETTINGS_TRANSPARENT)) {
@@ -618,20 +1007,21 @@ void view_expose (GtkWidget *window, cairo_t* context, struct view *view)
 	cairo_save(context);
 	cairo_scale(context, view->scalex, view->scaley);
 
-	/* draw highlights (pressed keys) */
-	view_draw_list(view, context, status_list_latched(view->status));
-	view_draw_list(view, context, status_list_locked(view->status));
+	/* draw highlights (pressed keys) in the damaged region only */
+	view_draw_list(view, context, status_list_latched(view->status), damage);
+	view_draw_list(view, context, status_list_locked(view->status), damage);
 
 	/* pressed and focused key */
-	view_draw_key(view, context, status_focus_get(view->status));
+	view_draw_key(view, context, status_focus_get(view->status), damage);
 	if (status_pressed_get(view->status)) {
 		state=status_pressed_get(view->status)->state;
 		key_state_set(status_pressed_get(view->status), KEY_PRESSED);
-		view_draw_key(view, context, status_pressed_get(view->status));
+		view_draw_key(view, context, status_pressed_get(view->status), damage);
 		key_state_set(status_pressed_get(view->status), state);
 	}
 
 	cairo_restore(context);
+	if (damage) cairo_region_destroy(damage);
 
 #ifdef ENABLE_RAMBLE
 	if (view->ramble) ramble_draw(view->ramble, context);
@@ -644,13 +1034,50 @@ void view_expose (GtkWidget *window, cairo_t* context, struct view *view)
 	END_FUNC
 }
 
+/* recompute the modifiers that change the symbols of the keys after a key map change.
+ * Done when idle: gdk updates its key map after the xkb event filters are called */
+gboolean view_sensitivity_update(gpointer user_data)
+{
+	START_FUNC
+	struct view *view=(struct view *)user_data;
+	GSList *list=view->keyboards;
+	while (list) {
+		keyboard_sensitivity_update((struct keyboard *)list->data, view->status->xkeyboard);
+		list=list->next;
+	}
+	/* the images derived with the former sensitivity are wrong */
+	view_symbols_flush(view);
+	gtk_widget_queue_draw(GTK_WIDGET(view->window));
+	view->sensitivity_id=0;
+	END_FUNC
+	return FALSE;
+}
+
 /* on keys changed events */
-void view_on_keys_changed(gpointer user_data)
+void view_on_keys_changed(gboolean map_changed, gpointer user_data)
 {
 	START_FUNC
 	struct view *view=(struct view *)user_data;
-	if (view->symbols) cairo_surface_destroy(view->symbols);
-	view->symbols=NULL;
+	GSList *list=view->keyboards;
+	if (map_changed) {
+		view_symbols_flush(view);
+		/* the keys may have become sensitive to other modifiers */
+		if (!view->sensitivity_id)
+			view->sensitivity_id=g_idle_add_full(G_PRIORITY_HIGH_IDLE, view_sensitivity_update, view, NULL);
+	} else {
+		/* group change: the symbols images of the groups are kept */
+		if (view->symbols) view_symbols_update(view);
+		/* the keyboards under another one have their symbols in the background */
+		while (list) {
+			if (keyboard_activated((struct keyboard *)list->data) &&
+				((struct keyboard *)list->data)->under) {
+				if (view->background) cairo_surface_destroy(view->background);
+				view->background=NULL;
+				break;
+			}
+			list=list->next;
+		}
+	}
 	gtk_widget_queue_draw(GTK_WIDGET(view->window));
 	END_FUNC
 }
@@ -689,10 +1116,11 @@ void view_update_extensions(GSettings *settings, gchar *key, gpointer user_data)
 
 	view_set_dimensions(view);
 	view_resize(view);
+	style_atlas_flush(view->style);
+	view_masks_update(view);
 	if (view->background) cairo_surface_destroy(view->background);
 	view->background=NULL;
-	if (view->symbols) cairo_surface_destroy(view->symbols);
-	view->symbols=NULL;
+	view_symbols_flush(view);
 	view_create_window_mask(view);
 	status_focus_set(view->status, NULL);
 	gtk_widget_queue_draw(GTK_WIDGET(view->window));
@@ -757,7 +1185,12 @@ void view_free(struct view *view)
 {
 	START_FUNC
 	if (view->background) cairo_surface_destroy(view->background);
-	if (view->symbols) cairo_surface_destroy(view->symbols);
+	if (view->prewarm_id) g_source_remove(view->prewarm_id);
+	if (view->sensitivity_id) g_source_remove(view->sensitivity_id);
+	if (view->masks_id) g_source_remove(view->masks_id);
+	view_timer_flush(view);
+	scheduler_free(view->scheduler);
+	g_list_free_full(view->symbols_cache, view_symbols_free);
 	g_free(view);
 	END_FUNC
 }
@@ -777,6 +1210,7 @@ struct view *view_new (struct status *status, struct style *style, GSList *keybo
 	view->scaley=settings_get_double(SETTINGS_SCALEY);
 	view_set_dimensions(view);
 	view->window=GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
+	view->scheduler=scheduler_new(GTK_WIDGET(view->window));
 	gtk_window_set_keep_above(view->window, settings_get_bool(SETTINGS_ALWAYS_ON_TOP));
  	gtk_window_set_accept_focus(view->window, FALSE);
 	gtk_window_set_skip_taskbar_hint(view->window, !settings_get_bool(SETTINGS_TASK_BAR));
@@ -818,6 +1252,8 @@ struct view *view_new (struct status *status, struct style *style, GSList *keybo
 	settings_changecb_register(SETTINGS_LABEL_OUTLINE, view_redraw, view);
 	settings_changecb_register(SETTINGS_ACTIVATED, view_redraw, view);
 	settings_changecb_register(SETTINGS_LATCHED, view_redraw, view);
+	settings_changecb_register(SETTINGS_MOUSEOVER, view_redraw, view);
+	settings_changecb_register(SETTINGS_TINT_SHAPES, view_redraw, view);
 	settings_changecb_register(SETTINGS_SYSTEM_FONT, view_redraw, view);
 	settings_changecb_register(SETTINGS_FONT, view_redraw, view);
 
@@ -38,12 +38,26 @@
 #include "key.h"
 #include "style.h"
 #include "status.h"
+#include "scheduler.h"
 #ifdef ENABLE_RAMBLE
 #include "ramble.h"
 #endif
 
 struct key;
 
+/* cached drawing of the focus key for the timer input method:
+ * the timer wedge is drawn by compositing the two images */
+struct view_timer {
+	cairo_surface_t *idle; /* focus key in the color of its state */
+	cairo_surface_t *active; /* focus key in the mouse over color */
+	struct key *key; /* key drawn in the images or NULL */
+	enum key_state state; /* state of the key drawn */
+	GdkModifierType globalmod; /* modifiers of the symbol drawn */
+	guint group; /* xkb group of the symbol drawn */
+	gint x, y, w, h; /* position and size of the images on the window */
+	gdouble value; /* timer value drawn */
+};
+
 /* This represents a view of florence. */
 struct view {
 	struct status *status; /* the status being represented by the view */
@@ -57,7 +71,14 @@ struct view {
 	gdouble xoffset, yoffset; /* offset of the main keyboard */
 	struct style *style; /* Do it with style */
 	cairo_surface_t *background; /* contains the background image of florence */
-	cairo_surface_t *symbols; /* contains the symbols image of florence */
+	cairo_surface_t *symbols; /* contains the symbols image of florence for the current state */
+	GList *symbols_cache; /* symbols images by modifier state, most recently used first */
+	guint prewarm_id; /* idle source drawing the symbols images of the common states */
+	guint sensitivity_id; /* idle source recomputing the modifier sensitivity of the keys */
+	guint masks_id; /* idle source computing the hit masks of the keys */
+	guint masks_next; /* index of the next keyboard to compute the hit masks of */
+	struct scheduler *scheduler; /* periodic work, driven by the frame clock of the window */
+	struct view_timer timer; /* focus key images for the timer input method */
 	gboolean hand_cursor; /* true when the cursor is a hand */
 	gulong configure_handler; /* configure signal handler id */
 #ifdef ENABLE_RAMBLE
@@ -84,6 +105,8 @@ void view_show (struct view *view);
 void view_hide (struct view *view);
 /* Redraw the key to the window */
 void view_update (struct view *view, struct key *key, gboolean statechange);
+/* Redraw the part of the timer wedge of the focus key that changed since it was drawn */
+void view_timer_update (struct view *view);
 /* Change the layout and style of the view and redraw */
 void view_update_layout(struct view *view, struct style *style, GSList *keyboards);
 
@@ -24,6 +24,10 @@
 #include "trace.h"
 #include <gdk/gdkx.h>
 
+/* key of the keyval table: key code, core modifiers and group */
+#define XKEYBOARD_KEYVAL_KEY(code, mod, group) \
+	GUINT_TO_POINTER((((guint)(group)&0xFF)<<16)|(((guint)(mod)&0xFF)<<8)|((code)&0xFF))
+
 /* liberate groups memory */
 void xkeyboard_groups_free(struct xkeyboard *xkeyboard) {
 	START_FUNC
@@ -178,13 +182,27 @@ GdkFilterReturn xkeyboard_event_handler(GdkXEvent *xevent, GdkEvent *event, gpoi
 	struct xkeyboard *xkeyboard=(struct xkeyboard *)data;
 	if (ev->xany.type==(xkeyboard->base_event_code+XkbEventCode)) {
 		xkbev=(XkbEvent *)ev;
-		if ((xkbev->any.xkb_type==XkbStateNotify)||(xkbev->any.xkb_type==XkbNewKeyboardNotify)) {
-			if (xkbev->any.xkb_type==XkbNewKeyboardNotify) {
+		switch (xkbev->any.xkb_type) {
+			case XkbNewKeyboardNotify:
 				xkeyboard_groups_free(xkeyboard);
 				xkeyboard_layout(xkeyboard);
-			}
+				XkbGetState((Display *)gdk_x11_get_default_xdisplay(), XkbUseCoreKbd,
+					&(xkeyboard->xkb_state));
+				xkeyboard->group=xkeyboard->xkb_state.group;
+				g_hash_table_remove_all(xkeyboard->keyvals);
+				break;
+			case XkbMapNotify:
+				g_hash_table_remove_all(xkeyboard->keyvals);
+				break;
+			case XkbStateNotify:
+				xkeyboard->group=xkbev->state.group;
+				break;
+			default: xkbev=NULL;
+		}
+		if (xkbev) {
 			flo_debug(TRACE_DEBUG, _("XKB state notify event received"));
-			if (xkeyboard->user_data) xkeyboard->event_cb(xkeyboard->user_data);
+			if (xkeyboard->user_data) xkeyboard->event_cb(
+				xkbev->any.xkb_type!=XkbStateNotify, xkeyboard->user_data);
 		}
 	}
 	END_FUNC
@@ -193,22 +211,25 @@ GdkFilterReturn xkeyboard_event_handler(GdkXEvent *xevent, GdkEvent *event, gpoi
 
 #endif
 
+/* returns the name of the layout following the group or NULL when no layout is known */
+gchar *xkeyboard_group_next_layout_get(struct xkeyboard *xkeyboard, guint group)
+{
+	START_FUNC
+	guint length=g_list_length(xkeyboard->groups);
+	if (!length) {
+		END_FUNC
+		return NULL;
+	}
+	END_FUNC
+	return (gchar *)g_list_nth_data(xkeyboard->groups, (group+1)%length);
+}
+
 /* returns the next layout name */
 gchar *xkeyboard_next_layout_get(struct xkeyboard *xkeyboard)
 {
 	START_FUNC
-#ifdef ENABLE_XKB
-	guint newgroup;
-	XkbStateRec xkbState;
-	Display *disp=(Display *)gdk_x11_get_default_xdisplay();
-	XkbGetState(disp, XkbUseCoreKbd, &xkbState);
-	newgroup=(xkbState.group+1)%g_list_length(xkeyboard->groups);
 	END_FUNC
-	return (gchar *)g_list_nth_data(xkeyboard->groups, newgroup);
-#else
-	END_FUNC
-	return (gchar *)g_list_nth_data(xkeyboard->groups, 0);
-#endif
+	return xkeyboard_group_next_layout_get(xkeyboard, xkeyboard->group);
 }
 
 /* switch keyboard layout */
@@ -216,11 +237,8 @@ void xkeyboard_layout_change(struct xkeyboard *xkeyboard)
 {
 	START_FUNC
 #ifdef ENABLE_XKB
-	guint newgroup;
-	XkbStateRec xkbState;
+	guint newgroup=(xkeyboard->group+1)%g_list_length(xkeyboard->groups);
 	Display *disp=(Display *)gdk_x11_get_default_xdisplay();
-	XkbGetState(disp, XkbUseCoreKbd, &xkbState);
-	newgroup=(xkbState.group+1)%g_list_length(xkeyboard->groups);
 	if (XkbLockGroup(disp, XkbUseCoreKbd, newgroup)) {
 		flo_debug(TRACE_DEBUG, _("switching to xkb layout %s"),
 			g_list_nth_data(xkeyboard->groups, newgroup));
@@ -229,6 +247,14 @@ void xkeyboard_layout_change(struct xkeyboard *xkeyboard)
 	END_FUNC
 }
 
+/* returns the current xkb group */
+guint xkeyboard_group_get(struct xkeyboard *xkeyboard)
+{
+	START_FUNC
+	END_FUNC
+	return xkeyboard->group;
+}
+
 /* register xkb events */
 void xkeyboard_register_events(struct xkeyboard *xkeyboard, xkeyboard_layout_changed event_cb, gpointer user_data)
 {
@@ -238,23 +264,63 @@ void xkeyboard_register_events(struct xkeyboard *xkeyboard, xkeyboard_layout_cha
 	END_FUNC
 }
 
-/* get keyval according to modifier */
-/* TODO: cache group state value */
-guint xkeyboard_getKeyval(struct xkeyboard *xkeyboard, guint code, GdkModifierType mod)
+/* get keyval according to modifier in the group.
+ * The keyvals are translated once and kept until the key map changes */
+guint xkeyboard_group_keyval_get(struct xkeyboard *xkeyboard, guint code, GdkModifierType mod, guint group)
 {
 	START_FUNC
 	guint keyval=0;
-	XkbStateRec xkbState;
-	Display *disp=(Display *)gdk_x11_get_default_xdisplay();
-	XkbGetState(disp, XkbUseCoreKbd, &xkbState);
-	if (!gdk_keymap_translate_keyboard_state(gdk_keymap_get_default(), code, mod, xkbState.group,
-		&keyval, NULL, NULL, NULL)) {
-		keyval=0;
+	gpointer value;
+	gboolean cached=(code<=0xFF) && (!(mod&~0xFF));
+	if (cached && g_hash_table_lookup_extended(xkeyboard->keyvals,
+		XKEYBOARD_KEYVAL_KEY(code, mod, group), NULL, &value)) {
+		keyval=GPOINTER_TO_UINT(value);
+	} else {
+		if (!gdk_keymap_translate_keyboard_state(gdk_keymap_get_default(), code, mod, group,
+			&keyval, NULL, NULL, NULL)) {
+			keyval=0;
+		}
+		if (cached) g_hash_table_insert(xkeyboard->keyvals,
+			XKEYBOARD_KEYVAL_KEY(code, mod, group), GUINT_TO_POINTER(keyval));
 	}
 	END_FUNC
 	return keyval;
 }
 
+/* get keyval according to modifier */
+guint xkeyboard_getKeyval(struct xkeyboard *xkeyboard, guint code, GdkModifierType mod)
+{
+	START_FUNC
+	END_FUNC
+	return xkeyboard_group_keyval_get(xkeyboard, code, mod, xkeyboard->group);
+}
+
+/* get the modifiers that change the keyval of the key code
+ * each modifier is tested alone and combined with the usual level modifiers, for every group */
+GdkModifierType xkeyboard_key_sensitivity_get(struct xkeyboard *xkeyboard, guint code)
+{
+	START_FUNC
+	static const GdkModifierType bases[]={ 0, GDK_SHIFT_MASK, GDK_LOCK_MASK, GDK_MOD2_MASK, GDK_MOD5_MASK };
+	GdkKeymap *keymap=gdk_keymap_get_default();
+	GdkModifierType ret=0;
+	guint keyval, keyval2;
+	guint group, base, bit;
+	for (group=0; group<MAX(g_list_length(xkeyboard->groups), 1); group++) {
+		for (base=0; base<G_N_ELEMENTS(bases); base++) {
+			if (!gdk_keymap_translate_keyboard_state(keymap, code, bases[base], group,
+				&keyval, NULL, NULL, NULL)) keyval=0;
+			for (bit=0; bit<8; bit++) {
+				if ((bases[base]|ret)&(1<<bit)) continue;
+				if (!gdk_keymap_translate_keyboard_state(keymap, code, bases[base]|(1<<bit), group,
+					&keyval2, NULL, NULL, NULL)) keyval2=0;
+				if (keyval!=keyval2) ret|=(1<<bit);
+			}
+		}
+	}
+	END_FUNC
+	return ret;
+}
+
 /* get the key properties (locker and modifier) from xkb */
 void xkeyboard_key_properties_get(struct xkeyboard *xkeyboard, guint code, GdkModifierType *mod, gboolean *locker)
 {
@@ -294,6 +360,123 @@ void xkeyboard_key_properties_get(struct xkeyboard *xkeyboard, guint code, GdkMo
 	END_FUNC
 }
 
+/* find the key code and the level modifiers that produce the keyval in the current group.
+ * level3 is the modifier of the third level (see xkeyboard_level3_get) or 0.
+ * returns FALSE when the keyval is not in the current group */
+gboolean xkeyboard_keyval_code_get(struct xkeyboard *xkeyboard, guint keyval, GdkModifierType level3,
+	guint *code, GdkModifierType *mod)
+{
+	START_FUNC
+	const GdkModifierType levels[]={ 0, GDK_SHIFT_MASK, level3, GDK_SHIFT_MASK|level3 };
+	GdkKeymapKey *keys;
+	gint n, i;
+	guint level;
+	gboolean ret=FALSE;
+	if (gdk_keymap_get_entries_for_keyval(gdk_keymap_get_default(), keyval, &keys, &n)) {
+		for (i=0; (!ret) && i<n; i++) {
+			if (keys[i].group!=xkeyboard->group) continue;
+			/* the level of the entry depends on the key type: look for the modifiers */
+			for (level=0; level<G_N_ELEMENTS(levels); level++) {
+				if ((level>=2) && !level3) break;
+				if (xkeyboard_group_keyval_get(xkeyboard, keys[i].keycode,
+					levels[level], xkeyboard->group)==keyval) {
+					*code=keys[i].keycode;
+					*mod=levels[level];
+					ret=TRUE;
+					break;
+				}
+			}
+		}
+		g_free(keys);
+	}
+	END_FUNC
+	return ret;
+}
+
+/* find a key code setting the modifier. returns 0 when there is none */
+guint xkeyboard_modifier_code_get(struct xkeyboard *xkeyboard, GdkModifierType mod)
+{
+	START_FUNC
+	GdkModifierType keymod;
+	gboolean locker;
+	guint code;
+	for (code=8; code<=0xFF; code++) {
+		xkeyboard_key_properties_get(xkeyboard, code, &keymod, &locker);
+		if ((!locker) && keymod==mod) break;
+	}
+	END_FUNC
+	return code>0xFF?0:code;
+}
+
+/* find the modifier of the third level and the key code setting it.
+ * returns 0 when the key map has no third level modifier */
+GdkModifierType xkeyboard_level3_get(struct xkeyboard *xkeyboard, guint *code)
+{
+	START_FUNC
+	GdkKeymapKey *keys;
+	GdkModifierType mod=0;
+	gboolean locker;
+	gint n, i;
+	*code=0;
+	if (gdk_keymap_get_entries_for_keyval(gdk_keymap_get_default(), GDK_KEY_ISO_Level3_Shift, &keys, &n)) {
+		for (i=0; (!mod) && i<n; i++) {
+			if (keys[i].level!=0) continue;
+			xkeyboard_key_properties_get(xkeyboard, keys[i].keycode, &mod, &locker);
+			if (locker) mod=0;
+			else if (mod) *code=keys[i].keycode;
+		}
+		g_free(keys);
+	}
+	END_FUNC
+	return mod;
+}
+
+/* get the locked and latched modifiers of the keyboard */
+void xkeyboard_mods_get(struct xkeyboard *xkeyboard, GdkModifierType *locked, GdkModifierType *latched)
+{
+	START_FUNC
+	*locked=0;
+	*latched=0;
+#ifdef ENABLE_XKB
+	XkbStateRec state;
+	if (XkbGetState((Display *)gdk_x11_get_default_xdisplay(), XkbUseCoreKbd, &state)==Success) {
+		*locked=state.locked_mods;
+		*latched=state.latched_mods;
+	}
+#endif
+	END_FUNC
+}
+
+/* find up to n key codes without any keyval. returns the number of codes found */
+guint xkeyboard_spare_codes_get(struct xkeyboard *xkeyboard, guint *codes, guint n)
+{
+	START_FUNC
+	guint *keyvals;
+	gint num, i;
+	guint code, ret=0;
+	gboolean spare;
+	/* the highest key codes are the least likely to be on a physical keyboard */
+	for (code=0xFF; (ret<n) && code>=8; code--) {
+		spare=TRUE;
+		if (gdk_keymap_get_entries_for_keycode(gdk_keymap_get_default(), code, NULL, &keyvals, &num)) {
+			for (i=0; spare && i<num; i++) if (keyvals[i]) spare=FALSE;
+			g_free(keyvals);
+		}
+		if (spare) codes[ret++]=code;
+	}
+	END_FUNC
+	return ret;
+}
+
+/* called by gdk when the key map changes */
+void xkeyboard_keys_changed(GdkKeymap *keymap, gpointer user_data)
+{
+	START_FUNC
+	struct xkeyboard *xkeyboard=(struct xkeyboard *)user_data;
+	g_hash_table_remove_all(xkeyboard->keyvals);
+	END_FUNC
+}
+
 /* returns a new allocated structure containing data from xkb */
 struct xkeyboard *xkeyboard_new()
 {
@@ -301,6 +484,9 @@ struct xkeyboard *xkeyboard_new()
 	struct xkeyboard *xkeyboard=g_malloc(sizeof(struct xkeyboard));
 	if (!xkeyboard) flo_fatal(_("Unable to allocate memory for xkeyboard data"));
 	memset(xkeyboard, 0, sizeof(struct xkeyboard));
+	xkeyboard->keyvals=g_hash_table_new(g_direct_hash, g_direct_equal);
+	xkeyboard->keys_changed_id=g_signal_connect(G_OBJECT(gdk_keymap_get_default()), "keys-changed",
+		G_CALLBACK(xkeyboard_keys_changed), xkeyboard);
 
 #ifdef ENABLE_XKB
 	int maj=XkbMajorVersion;
@@ -319,7 +505,8 @@ struct xkeyboard *xkeyboard_new()
 
 	xkeyboard_layout(xkeyboard);
 	XkbSelectEvents(gdk_x11_display_get_xdisplay(gdk_display_get_default()),
-		XkbUseCoreKbd, XkbNewKeyboardNotifyMask, XkbNewKeyboardNotifyMask);
+		XkbUseCoreKbd, XkbNewKeyboardNotifyMask|XkbMapNotifyMask,
+		XkbNewKeyboardNotifyMask|XkbMapNotifyMask);
 	XkbSelectEventDetails(gdk_x11_display_get_xdisplay(gdk_display_get_default()),
 		XkbUseCoreKbd, XkbStateNotify, XkbAllStateComponentsMask, XkbGroupStateMask);
 	gdk_window_add_filter(NULL, xkeyboard_event_handler, xkeyboard);
@@ -329,6 +516,7 @@ struct xkeyboard *xkeyboard_new()
 	XkbKeyActionsMask|XkbModifierMapMask, XkbUseCoreKbd);
 	/* get modifiers state */
 	XkbGetState((Display *)gdk_x11_get_default_xdisplay(), XkbUseCoreKbd, &(xkeyboard->xkb_state));
+	xkeyboard->group=xkeyboard->xkb_state.group;
 #else
 	flo_warn(_("XKB not compiled: startup keyboard sync is disabled. You should make sure all locker keys are released."));
 #endif
@@ -356,6 +544,8 @@ void xkeyboard_free(struct xkeyboard *xkeyboard)
 {
 	START_FUNC
 	xkeyboard_groups_free(xkeyboard);
+	g_signal_handler_disconnect(G_OBJECT(gdk_keymap_get_default()), xkeyboard->keys_changed_id);
+	g_hash_table_destroy(xkeyboard->keyvals);
 	g_free(xkeyboard);
 	END_FUNC
 }
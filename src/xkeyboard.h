@@ -28,8 +28,9 @@
 #include <glib.h>
 #include <gdk/gdk.h>
 
-/* callback for when the key map is changed */
-typedef void (*xkeyboard_layout_changed)(gpointer user_data);
+/* callback for when the key map or the group is changed.
+ * map_changed is FALSE when only the group changed */
+typedef void (*xkeyboard_layout_changed)(gboolean map_changed, gpointer user_data);
 
 /* this structure contains xkb data */
 struct xkeyboard {
@@ -39,21 +40,48 @@ struct xkeyboard {
         XkbStateRec xkb_state; /* Keyboard Status (get from XKB) */
 #endif
 	GList *groups; /* list of xkb configured groups (layout names) */
+	guint group; /* current xkb group, updated by the xkb state events */
+	GHashTable *keyvals; /* keyvals by key code, modifiers and group */
+	gulong keys_changed_id; /* handler of the keymap changes */
 	xkeyboard_layout_changed event_cb; /* callback to be called on xkb events */
 	gpointer user_data; /* user data to be passed to the event callback */
 };
 
 /* returns the next layout name */
 gchar *xkeyboard_next_layout_get(struct xkeyboard *xkeyboard);
+/* returns the name of the layout following the group or NULL when no layout is known */
+gchar *xkeyboard_group_next_layout_get(struct xkeyboard *xkeyboard, guint group);
 
 /* switch keyboard layout */
 void xkeyboard_layout_change(struct xkeyboard *xkeyboard);
 
+/* returns the current xkb group */
+guint xkeyboard_group_get(struct xkeyboard *xkeyboard);
+
 /* register xkb events */
 void xkeyboard_register_events(struct xkeyboard *xkeyboard, xkeyboard_layout_changed event_cb, gpointer user_data);
 
 /* get keyval according to modifier */
 guint xkeyboard_getKeyval(struct xkeyboard *xkeyboard, guint code, GdkModifierType mod);
+/* get keyval according to modifier in the group */
+guint xkeyboard_group_keyval_get(struct xkeyboard *xkeyboard, guint code, GdkModifierType mod, guint group);
+
+/* get the modifiers that change the keyval of the key code */
+GdkModifierType xkeyboard_key_sensitivity_get(struct xkeyboard *xkeyboard, guint code);
+
+/* find the key code and the level modifiers that produce the keyval in the current group.
+ * level3 is the modifier of the third level (see xkeyboard_level3_get) or 0.
+ * returns FALSE when the keyval is not in the current group */
+gboolean xkeyboard_keyval_code_get(struct xkeyboard *xkeyboard, guint keyval, GdkModifierType level3,
+	guint *code, GdkModifierType *mod);
+/* find the modifier of the third level and the key code setting it. returns 0 when there is none */
+GdkModifierType xkeyboard_level3_get(struct xkeyboard *xkeyboard, guint *code);
+/* get the locked and latched modifiers of the keyboard */
+void xkeyboard_mods_get(struct xkeyboard *xkeyboard, GdkModifierType *locked, GdkModifierType *latched);
+/* find a key code setting the modifier. returns 0 when there is none */
+guint xkeyboard_modifier_code_get(struct xkeyboard *xkeyboard, GdkModifierType mod);
+/* find up to n key codes without any keyval. returns the number of codes found */
+guint xkeyboard_spare_codes_get(struct xkeyboard *xkeyboard, guint *codes, guint n);
 
 /* get the key properties (locker and modifier) from xkb */
 void xkeyboard_key_properties_get(struct xkeyboard *xkeyboard, guint code, GdkModifierType *mod, gboolean *locker);